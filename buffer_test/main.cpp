@@ -4,6 +4,8 @@
 #include <random>
 
 #include "editors/code/interpretation.h"
+#include "editors/code/rendering.h"
+#include "editors/code/view.h"
 
 using namespace std;
 
@@ -83,8 +85,46 @@ byte_string convert_to_byte_string(const string &str) {
 	return byte_string(reinterpret_cast<const std::byte*>(str.c_str()));
 }
 
+/// Folds a region inside a single visual line and checks that the cached layout of the line is discarded in the
+/// same way as \ref contents_region does it, although the line's key in the \ref line_layout_cache is unchanged.
+void check_layout_cache_folding() {
+	auto buf = make_shared<buffer>(0);
+	interpretation interp(buf, encoding_manager::get().get_default());
+	caret_set cset;
+	cset.reset();
+	interp.on_insert(cset, convert_to_byte_string("int f(int a, int b);\nint g();"), nullptr);
+
+	view_formatting fmt(interp);
+	line_layout_cache cache;
+	visual_line_registry::line_info info = fmt.get_visual_lines().get_line_info(0);
+	visual_line_registry::node_data line = *info.entry;
+	line_layout layout;
+	layout.length = line.length;
+	layout.type = line.type;
+	cache.insert(info.first_char, std::move(layout));
+	assert_true_logical(cache.find(info.first_char, line.length, line.type, 0.0) != nullptr);
+
+	view_formatting::fold_region fr(6, 18); // "int a, int b"
+	fmt.add_folded_region(fr);
+	info = fmt.get_visual_lines().get_line_info(0);
+	assert_true_logical(info.entry->length == line.length && info.entry->type == line.type);
+	cache.invalidate(fr.first, fr.second);
+	assert_true_logical(cache.find(info.first_char, info.entry->length, info.entry->type, 0.0) == nullptr);
+
+	// unfolding the region must discard the layout with the fold as well
+	layout = line_layout();
+	layout.length = info.entry->length;
+	layout.type = info.entry->type;
+	cache.insert(info.first_char, std::move(layout));
+	fr = fmt.remove_folded_region(fmt.get_folding().find_region_containing_open(fr.first + 1).entry);
+	cache.invalidate(fr.first, fr.second);
+	info = fmt.get_visual_lines().get_line_info(0);
+	assert_true_logical(cache.find(info.first_char, info.entry->length, info.entry->type, 0.0) == nullptr);
+}
+
 int main(int argc, char **argv) {
 	initialize(argc, argv);
+	check_layout_cache_folding();
 	default_random_engine eng(123456);
 	auto buf = make_shared<buffer>(0);
 	interpretation interp(buf, encoding_manager::get().get_default());
@@ -33,6 +33,7 @@ using namespace codepad::editors::code;
 
 namespace codepad {
 	double minimap::_target_height = 2.0;
+	minimap::page_rendering_mode minimap::_rendering_mode = minimap::page_rendering_mode::automatic;
 
 	std::unique_ptr<logger> logger::_current;
 
@@ -7,6 +7,7 @@
 /// Implementation of \ref codepad::editors::binary::contents_region.
 
 #include <algorithm>
+#include <array>
 #include <string_view>
 
 #include "../../ui/element.h"
@@ -330,6 +331,15 @@ namespace codepad::editors::binary {
 			return str_view_t(_lut[static_cast<unsigned char>(b)], 2);
 		}
 
+		/// The cached rendering of a byte.
+		struct _byte_rendering {
+			std::unique_ptr<ui::plain_text> text; ///< The rendered hexadecimal representation.
+			double offset = 0.0; ///< The horizontal offset used to center the text in its column.
+		};
+
+		/// Cached renderings of all byte values, indexed by the value. These are created when first needed, and
+		/// discarded when the font or the font size changes.
+		mutable std::array<_byte_rendering, 256> _byte_renderings;
 		caret_set _carets; ///< The set of carets.
 		interaction_manager<caret_set> _interaction_manager; ///< Manages certain mouse and keyboard interactions.
 		std::unique_ptr<ui::font> _font; ///< The font used to display all bytes.
@@ -433,7 +443,23 @@ namespace codepad::editors::binary {
 			return res;
 		}
 
-		/// Renders all visible bytes.
+		/// Returns \ref _byte_renderings, creating the renderings first if necessary.
+		const std::array<_byte_rendering, 256> &_get_byte_renderings() const {
+			if (!_byte_renderings[0].text) {
+				auto &renderer = get_manager().get_renderer();
+				for (std::size_t i = 0; i < _byte_renderings.size(); ++i) {
+					_byte_rendering &rendering = _byte_renderings[i];
+					rendering.text = renderer.create_plain_text(
+						_get_hex_byte(static_cast<std::byte>(i)), *_font, _font_size
+					);
+					rendering.offset = 0.5 * (_cached_max_byte_width - rendering.text->get_width());
+				}
+			}
+			return _byte_renderings;
+		}
+
+		/// Renders all visible bytes. The visible bytes are copied out of the \ref buffer with a single lookup,
+		/// and each byte is drawn using its cached rendering in \ref _byte_renderings.
 		void _custom_render() const override {
 			interactive_contents_region_base::_custom_render();
 
@@ -466,26 +492,27 @@ namespace codepad::editors::binary {
 					);
 
 					// render bytes
-					for (std::size_t line = firstline; topleft.y < bottom; topleft.y += lineh, ++line) {
+					const std::array<_byte_rendering, 256> &renderings = _get_byte_renderings();
+					std::size_t
+						bytes_per_row = get_bytes_per_row(),
+						numlines = static_cast<std::size_t>(std::ceil((bottom - topleft.y) / lineh)),
+						visbeg = std::min(firstline * bytes_per_row, _buf->length()),
+						visend = std::min(visbeg + numlines * bytes_per_row, _buf->length());
+					// use const iterators so that mapped chunks are not materialized
+					const editors::buffer &contents = *_buf;
+					byte_string bytes = contents.get_clip(contents.at(visbeg), contents.at(visend));
+					for (std::size_t rowbeg = 0; rowbeg < bytes.size(); rowbeg += bytes_per_row, topleft.y += lineh) {
 						// render a single line
-						std::size_t pos = line * get_bytes_per_row() + firstbyte;
-						if (pos >= _buf->length()) {
-							break;
-						}
-						auto it = _buf->at(pos);
+						std::size_t rowend = std::min(rowbeg + lastbyte, bytes.size());
 						double x = topleft.x;
 						for (
-							std::size_t i = firstbyte;
-							i < lastbyte && it != _buf->end();
-							++i, ++it, x += _cached_max_byte_width + _blank_width
+							std::size_t i = rowbeg + firstbyte;
+							i < rowend;
+							++i, x += _cached_max_byte_width + _blank_width
 							) {
-							auto text = renderer.create_plain_text(_get_hex_byte(*it), *_font, _font_size);
+							const _byte_rendering &rendering = renderings[static_cast<unsigned char>(bytes[i])];
 							// TODO customizable color
-							renderer.draw_plain_text(
-								*text,
-								vec2d(x + 0.5 * (_cached_max_byte_width - text->get_width()), topleft.y),
-								colord()
-							);
+							renderer.draw_plain_text(*rendering.text, vec2d(x + rendering.offset, topleft.y), colord());
 						}
 					}
 					// render carets
@@ -614,8 +641,11 @@ namespace codepad::editors::binary {
 			_on_carets_changed();
 		}
 
-		/// Updates cached bytes per row, and invalidates the visuals of this element.
+		/// Discards \ref _byte_renderings, updates cached bytes per row, and invalidates the visuals of this element.
 		void _on_font_parameters_changed() {
+			for (_byte_rendering &rendering : _byte_renderings) {
+				rendering.text.reset();
+			}
 			_cached_max_byte_width = get_font_size() * 2.0 * _font->get_maximum_character_width_em(
 				reinterpret_cast<const codepoint*>(U"0123456789ABCDEF")
 			);
@@ -11,6 +11,9 @@
 #include <string>
 #include <algorithm>
 #include <fstream>
+#include <iterator>
+#include <type_traits>
+#include <utility>
 
 #include "../core/bst.h"
 #include "../core/profiling.h"
@@ -41,9 +44,140 @@ namespace codepad::editors {
 	public:
 		/// The maximum number of bytes there can be in a single chunk.
 		constexpr static std::size_t maximum_bytes_per_chunk = 4096;
+		/// The number of bytes in a chunk that refers to a memory-mapped file.
+		constexpr static std::size_t bytes_per_mapped_chunk = 1024 * 1024;
+
+		/// Determines how the contents of a file are loaded into a \ref buffer.
+		enum class load_mode : unsigned char {
+			read, ///< The whole file is read into memory.
+			/// The file is mapped into memory. The contents of a chunk is only copied into memory when the chunk is
+			/// modified, or when a mutable iterator to it is created, so that the memory usage does not depend on
+			/// the size of the file. The file should not be modified externally while it's mapped.
+			mapped
+		};
 
-		/// Stores the contents of a chunk.
-		using chunk_data = byte_array;
+		/// Stores the contents of a chunk. A chunk either owns its bytes, or refers to part of a file mapped into
+		/// memory by a \ref buffer loaded with \ref load_mode::mapped. Mapped chunks are materialized, i.e., their
+		/// contents are copied, when they're modified or when mutable iterators to them are requested. Erasing
+		/// bytes from either end of a mapped chunk does not materialize it, and \ref buffer splits mapped chunks
+		/// instead of erasing bytes from the middle of them.
+		class chunk_data {
+		public:
+			using value_type = std::byte; ///< The type of the bytes.
+			using iterator = std::byte*; ///< Iterators to the bytes.
+			using const_iterator = const std::byte*; ///< Const iterators to the bytes.
+
+			/// Default constructor.
+			chunk_data() = default;
+			/// Initializes this chunk with a copy of the given range of bytes.
+			template <typename It> chunk_data(It beg, It end) : _bytes(beg, end) {
+			}
+
+			/// Returns a chunk that refers to the given range of mapped memory.
+			inline static chunk_data mapped(const std::byte *beg, const std::byte *end) {
+				chunk_data result;
+				result._mapped_begin = beg;
+				result._mapped_end = end;
+				return result;
+			}
+			/// Returns a chunk containing the given range of this chunk. If this chunk is mapped, the result refers to
+			/// the same memory; otherwise the bytes are copied.
+			chunk_data sub_chunk(const_iterator beg, const_iterator end) const {
+				return is_mapped() ? mapped(beg, end) : chunk_data(beg, end);
+			}
+			/// Returns whether this chunk refers to mapped memory.
+			bool is_mapped() const {
+				return _mapped_begin != nullptr;
+			}
+
+			/// Returns an iterator to the first byte.
+			const_iterator begin() const {
+				return is_mapped() ? _mapped_begin : _bytes.data();
+			}
+			/// Returns an iterator past the last byte.
+			const_iterator end() const {
+				return is_mapped() ? _mapped_end : _bytes.data() + _bytes.size();
+			}
+			/// Materializes this chunk and returns an iterator to the first byte.
+			iterator begin() {
+				_materialize();
+				return _bytes.data();
+			}
+			/// Materializes this chunk and returns an iterator past the last byte.
+			iterator end() {
+				_materialize();
+				return _bytes.data() + _bytes.size();
+			}
+			/// Materializes this chunk and returns a pointer to its bytes.
+			std::byte *data() {
+				return begin();
+			}
+			/// Returns the number of bytes in this chunk.
+			std::size_t size() const {
+				return is_mapped() ? static_cast<std::size_t>(_mapped_end - _mapped_begin) : _bytes.size();
+			}
+			/// Returns whether this chunk is empty.
+			bool empty() const {
+				return size() == 0;
+			}
+
+			/// Materializes this chunk and reserves memory for the given number of bytes.
+			void reserve(std::size_t n) {
+				_materialize();
+				_bytes.reserve(n);
+			}
+			/// Materializes this chunk and resizes it.
+			void resize(std::size_t n) {
+				_materialize();
+				_bytes.resize(n);
+			}
+			/// Materializes this chunk and appends a byte.
+			void emplace_back(std::byte b) {
+				_materialize();
+				_bytes.emplace_back(b);
+			}
+			/// Erases the given range of bytes.
+			void erase(const_iterator beg, const_iterator end) {
+				if (is_mapped()) {
+					if (beg == _mapped_begin) {
+						_mapped_begin = end;
+						return;
+					}
+					if (end == _mapped_end) {
+						_mapped_end = beg;
+						return;
+					}
+				}
+				auto
+					begoff = static_cast<std::ptrdiff_t>(beg - std::as_const(*this).begin()),
+					endoff = static_cast<std::ptrdiff_t>(end - std::as_const(*this).begin());
+				_materialize();
+				_bytes.erase(_bytes.begin() + begoff, _bytes.begin() + endoff);
+			}
+			/// Inserts the given range of bytes before the given position. Nothing is done, and this chunk is not
+			/// materialized, if the range is empty.
+			template <typename It> void insert(const_iterator pos, It beg, It end) {
+				if (beg == end) {
+					return;
+				}
+				auto offset = static_cast<std::ptrdiff_t>(pos - std::as_const(*this).begin());
+				_materialize();
+				_bytes.insert(_bytes.begin() + offset, beg, end);
+			}
+		protected:
+			byte_array _bytes; ///< The bytes owned by this chunk, if it's not mapped.
+			const std::byte
+				*_mapped_begin = nullptr, ///< The beginning of the mapped memory, or \p nullptr.
+				*_mapped_end = nullptr; ///< The end of the mapped memory.
+
+			/// Copies the mapped bytes into \ref _bytes if this chunk is mapped.
+			void _materialize() {
+				if (is_mapped()) {
+					_bytes.assign(_mapped_begin, _mapped_end);
+					_mapped_begin = _mapped_end = nullptr;
+				}
+			}
+		};
 
 		/// Stores additional data of a node in the tree.
 		struct node_data {
@@ -76,8 +210,8 @@ namespace codepad::editors {
 			friend buffer;
 		public:
 			using value_type = std::byte; ///< Type of values pointed to by these iterators.
-			using pointer = typename SIt::pointer; ///< Pointers to underlying elements.
-			using reference = typename SIt::reference; ///< References to underlying elements.
+			using pointer = typename std::iterator_traits<SIt>::pointer; ///< Pointers to underlying elements.
+			using reference = typename std::iterator_traits<SIt>::reference; ///< References to underlying elements.
 
 			/// Default constructor.
 			iterator_base() = default;
@@ -91,7 +225,7 @@ namespace codepad::editors {
 				if (++_s == _it->end()) {
 					_chunkpos += _it->size();
 					++_it;
-					_s = (_it != _it.get_container()->end() ? _it.get_value_rawmod().begin() : SIt());
+					_s = (_it != _it.get_container()->end() ? _chunk_begin(_it) : SIt());
 				}
 				return *this;
 			}
@@ -106,7 +240,7 @@ namespace codepad::editors {
 				if (_it == _it.get_container()->end() || _s == _it->begin()) {
 					--_it;
 					_chunkpos -= _it->size();
-					_s = _it.get_value_rawmod().end();
+					_s = _chunk_end(_it);
 				}
 				--_s;
 				return *this;
@@ -144,6 +278,26 @@ namespace codepad::editors {
 			iterator_base(const TIt &t, const SIt &s, std::size_t chkpos) : _it(t), _s(s), _chunkpos(chkpos) {
 			}
 
+			/// Returns an iterator to the first byte of the given chunk. Mapped chunks are only materialized for
+			/// mutable iterators.
+			inline static SIt _chunk_begin(const TIt &it) {
+				if constexpr (std::is_const_v<std::remove_pointer_t<SIt>>) {
+					return it->begin();
+				} else {
+					return it.get_value_rawmod().begin();
+				}
+			}
+			/// Returns an iterator past the last byte of the given chunk.
+			///
+			/// \sa _chunk_begin()
+			inline static SIt _chunk_end(const TIt &it) {
+				if constexpr (std::is_const_v<std::remove_pointer_t<SIt>>) {
+					return it->end();
+				} else {
+					return it.get_value_rawmod().end();
+				}
+			}
+
 			TIt _it; ///< The tree's iterator.
 			SIt _s{}; ///< The chunk's iterator.
 			std::size_t _chunkpos = 0; ///< The position of the first byte of \ref _it in the \ref buffer.
@@ -306,12 +460,12 @@ namespace codepad::editors {
 				modification mod;
 				mod.position = pos;
 				if (eraselen > 0) {
-					const_iterator posit = _buf->at(pos), endit = _buf->at(pos + eraselen);
+					const_iterator posit = _at(pos), endit = _at(pos + eraselen);
 					mod.removed_content = _buf->get_clip(posit, endit);
 					_buf->_erase(posit, endit);
 				}
 				if (!insert.empty()) {
-					_buf->_insert(_buf->at(pos), insert.begin(), insert.end());
+					_buf->_insert(_at(pos), insert.begin(), insert.end());
 					mod.added_content = std::move(insert);
 				}
 				_diff += mod.added_content.size() - mod.removed_content.size();
@@ -330,10 +484,10 @@ namespace codepad::editors {
 			void undo(const modification &mod) {
 				std::size_t pos = mod.position + _diff;
 				if (!mod.added_content.empty()) {
-					_buf->_erase(_buf->at(pos), _buf->at(pos + mod.added_content.size()));
+					_buf->_erase(_at(pos), _at(pos + mod.added_content.size()));
 				}
 				if (!mod.removed_content.empty()) {
-					_buf->_insert(_buf->at(pos), mod.removed_content.begin(), mod.removed_content.end());
+					_buf->_insert(_at(pos), mod.removed_content.begin(), mod.removed_content.end());
 				}
 				_diff += mod.removed_content.size() - mod.added_content.size();
 				_pos.emplace_back(pos, mod.added_content.size(), mod.removed_content.size());
@@ -343,10 +497,10 @@ namespace codepad::editors {
 			void redo(const modification &mod) {
 				// the modification already stores adjusted positions
 				if (!mod.removed_content.empty()) {
-					_buf->_erase(_buf->at(mod.position), _buf->at(mod.position + mod.removed_content.size()));
+					_buf->_erase(_at(mod.position), _at(mod.position + mod.removed_content.size()));
 				}
 				if (!mod.added_content.empty()) {
-					_buf->_insert(_buf->at(mod.position), mod.added_content.begin(), mod.added_content.end());
+					_buf->_insert(_at(mod.position), mod.added_content.begin(), mod.added_content.end());
 				}
 				_diff += mod.added_content.size() - mod.removed_content.size();
 				_pos.emplace_back(mod.position, mod.removed_content.size(), mod.added_content.size());
@@ -360,6 +514,12 @@ namespace codepad::editors {
 			/// Used to adjust positions obtained before modifications are made. Note that although its value may
 			/// overflow, it'll still work as intended.
 			std::size_t _diff = 0;
+
+			/// Returns a \ref const_iterator to the given position of \ref _buf. Unlike mutable iterators, this
+			/// does not materialize mapped chunks.
+			const_iterator _at(std::size_t pos) const {
+				return std::as_const(*_buf).at(pos);
+			}
 		};
 		/// A wrapper for \ref modifier that automatically calls \ref modifier::begin() upon construction and
 		/// \ref modifier::end() upon destruction. The edit type can only be \ref edit_type::normal.
@@ -389,12 +549,17 @@ namespace codepad::editors {
 		/// Constructs this \ref buffer with the given buffer index.
 		explicit buffer(std::size_t id) : _fileid(std::in_place_type<std::size_t>, id) {
 		}
-		/// Constructs this \ref buffer with the given file name, and loads that file's contents.
-		explicit buffer(const std::filesystem::path &filename) :
+		/// Constructs this \ref buffer with the given file name, and loads that file's contents. If \p mode is
+		/// \ref load_mode::mapped but the file cannot be mapped, the file is read instead.
+		explicit buffer(const std::filesystem::path &filename, load_mode mode = load_mode::read) :
 			_fileid(std::in_place_type<std::filesystem::path>, filename) {
 
 			performance_monitor mon(CP_STRLIT("load file"), performance_monitor::log_condition::always);
 
+			if (mode == load_mode::mapped && _load_mapped(filename)) {
+				return;
+			}
+
 			// read version
 			os::file f(filename, os::access_rights::read, os::open_mode::open);
 			if (f.valid()) {
@@ -506,7 +671,7 @@ namespace codepad::editors {
 			if (t == _t.end()) {
 				return const_iterator(t, chunk_data::const_iterator(), length());
 			}
-			return const_iterator(t, t->begin() + bytepos, bytepos - chkpos);
+			return const_iterator(t, t->begin() + chkpos, bytepos - chkpos);
 		}
 
 		/// Given a \ref const_iterator, returns the position of the byte it points to.
@@ -586,6 +751,11 @@ namespace codepad::editors {
 			_t.clear();
 		}
 
+		/// Returns whether this buffer has been loaded with \ref load_mode::mapped.
+		bool is_mapped() const {
+			return _mapping.valid();
+		}
+
 		info_event<begin_edit_info> begin_edit; ///< Invoked when this \ref buffer is about to be modified.
 		info_event<end_edit_info> end_edit; ///< Invoked when this \ref buffer has been modified.
 	protected:
@@ -598,6 +768,13 @@ namespace codepad::editors {
 				return;
 			}
 			if (beg._it == end._it) { // same chunk
+				if (beg._it->is_mapped() && beg._s != beg._it->begin() && end._s != beg._it->end()) {
+					// split the mapped chunk into two instead of copying it
+					tree_type::const_iterator next = beg._it;
+					_t.emplace_before(++next, beg._it->sub_chunk(end._s, beg._it->end()));
+					_t.get_modifier_for(beg._it.get_node())->erase(beg._s, beg._it->end());
+					return;
+				}
 				_t.get_modifier_for(beg._it.get_node())->erase(beg._s, end._s);
 				_try_merge_small_nodes(beg._it);
 				return;
@@ -628,7 +805,7 @@ namespace codepad::editors {
 			tree_type::const_iterator insit = pos._it, updit = insit;
 			chunk_data afterstr, *curstr;
 			std::vector<chunk_data> strs; // the buffer for (not all) inserted bytes
-			if (pos == begin()) { // insert at the very beginning, no need to split or update
+			if (pos == std::as_const(*this).begin()) { // insert at the very beginning, no need to split or update
 				updit = _t.end();
 				chunk_data st;
 				st.reserve(maximum_bytes_per_chunk);
@@ -640,13 +817,14 @@ namespace codepad::editors {
 				curstr = &updit.get_value_rawmod();
 			} else { // insert at the middle of a chunk
 				// save the second part & truncate the chunk
-				afterstr = chunk_data(pos._s, pos._it->end());
+				afterstr = pos._it->sub_chunk(pos._s, pos._it->end());
 				pos._it.get_value_rawmod().erase(pos._s, pos._it->end());
 				++insit;
 				curstr = &updit.get_value_rawmod();
 			}
 			for (auto it = beg; it != end; ++it) { // insert codepoints
-				if (curstr->size() == maximum_bytes_per_chunk) { // curstr would be too long, add a new chunk
+				// curstr would be too long or is mapped, add a new chunk
+				if (curstr->size() >= maximum_bytes_per_chunk || curstr->is_mapped()) {
 					strs.emplace_back();
 					curstr = &strs.back();
 					curstr->reserve(maximum_bytes_per_chunk);
@@ -695,6 +873,34 @@ namespace codepad::editors {
 				return;
 			}
 		}
+		/// Maps the given file into memory, and fills \ref _t with chunks that refer to the mapped memory.
+		///
+		/// \return Whether the file has been mapped. Empty files are never mapped.
+		bool _load_mapped(const std::filesystem::path &filename) {
+			os::file f(filename, os::access_rights::read, os::open_mode::open);
+			if (!f.valid()) {
+				return false;
+			}
+			auto size = static_cast<std::size_t>(f.get_size());
+			if (size == 0) {
+				return false;
+			}
+			_mapping.map(f, os::access_rights::read);
+			if (!_mapping.valid()) {
+				return false;
+			}
+			const auto *ptr = static_cast<const std::byte*>(_mapping.get_mapped_pointer());
+			const std::byte *end = ptr + size;
+			std::vector<chunk_data> chunks;
+			chunks.reserve((size + bytes_per_mapped_chunk - 1) / bytes_per_mapped_chunk);
+			while (ptr != end) {
+				const std::byte *next = ptr + std::min(static_cast<std::size_t>(end - ptr), bytes_per_mapped_chunk);
+				chunks.emplace_back(chunk_data::mapped(ptr, next));
+				ptr = next;
+			}
+			_t.insert_range_before_move(_t.end(), chunks.begin(), chunks.end());
+			return true;
+		}
 		/// Adds an \ref edit to the history of this buffer.
 		void _append_edit(edit edt) {
 			if (_curedit < _history.size()) {
@@ -705,6 +911,8 @@ namespace codepad::editors {
 		}
 
 		tree_type _t; ///< The underlying binary tree that stores all the chunks.
+		/// The mapped file if this buffer has been loaded with \ref load_mode::mapped.
+		os::file_mapping _mapping;
 		std::vector<edit> _history; ///< Records undoable or redoable edits made to this \ref buffer.
 		/// Used to identify this buffer. Also stores the path to the associated file, if one exists.
 		std::variant<std::size_t, std::filesystem::path> _fileid;
@@ -29,9 +29,11 @@ namespace codepad::editors {
 		friend buffer;
 	public:
 		/// Returns a \p std::shared_ptr<buffer> to the file specified by the given file name. If the file has not
-		/// been opened, this function opens the file; otherwise, it returns the pointer returned by previous calls
-		/// to this function. The file must exist.
-		std::shared_ptr<buffer> open_file(std::filesystem::path path) {
+		/// been opened, this function opens the file using the given \ref buffer::load_mode; otherwise, it returns
+		/// the pointer returned by previous calls to this function. The file must exist.
+		std::shared_ptr<buffer> open_file(
+			std::filesystem::path path, buffer::load_mode mode = buffer::load_mode::read
+		) {
 			// check for existing file
 			path = std::filesystem::canonical(path);
 			auto ins = _file_map.try_emplace(path);
@@ -41,7 +43,7 @@ namespace codepad::editors {
 				return ptr;
 			}
 			// create new one
-			auto res = std::make_shared<buffer>(path);
+			auto res = std::make_shared<buffer>(path, mode);
 			ins.first->second.buf = res;
 			/*res->_tags.resize(_tag_alloc_max);*/ // allocate space for tags
 			buffer_created.invoke_noret(*res);
@@ -0,0 +1,391 @@
+// Copyright (c) the Codepad contributors. All rights reserved.
+// Licensed under the Apache License, Version 2.0. See LICENSE.txt in the project root for license information.
+
+#pragma once
+
+/// \file
+/// Classes used to keep track of brackets in an \ref codepad::editors::code::interpretation.
+
+#include <optional>
+
+#include "../../core/bst.h"
+#include "interpretation.h"
+
+namespace codepad::editors::code {
+	/// Records the positions of all brackets in an \ref interpretation and keeps them up-to-date after edits. The
+	/// brackets are stored in a \ref binary_tree, with positions relative to the previous bracket and the nesting
+	/// depth change of each bracket, so that both shifting brackets after an edit and finding matching brackets
+	/// take logarithmic time. Brackets of all types share the same depth, so mismatched brackets may be matched
+	/// with each other.
+	///
+	/// \todo Skip brackets in strings and comments.
+	class bracket_registry {
+	public:
+		/// A pair of opening and closing brackets.
+		using bracket_pair = std::pair<codepoint, codepoint>;
+		/// A block enclosed by a pair of brackets, stored as the positions of the opening and the closing
+		/// bracket.
+		using block = std::pair<std::size_t, std::size_t>;
+
+		/// Initializes the registry with the default set of brackets: parentheses, square brackets, and braces.
+		explicit bracket_registry(std::shared_ptr<interpretation> interp) : bracket_registry(
+			std::move(interp), { bracket_pair('(', ')'), bracket_pair('[', ']'), bracket_pair('{', '}') }
+		) {
+		}
+		/// Initializes the registry with the given pairs of brackets, and scans the whole document for brackets.
+		bracket_registry(std::shared_ptr<interpretation> interp, std::vector<bracket_pair> pairs) :
+			_pairs(std::move(pairs)), _interp(std::move(interp)) {
+
+			_mod_tok = (_interp->end_edit_interpret += [this](buffer::end_edit_info&) {
+				_on_end_edit();
+			});
+
+			std::vector<bracket_data> brackets;
+			std::size_t last = 0;
+			_scan(0, _interp->get_linebreaks().num_chars(), last, brackets);
+			_t.insert_range_before_move(_t.end(), brackets.begin(), brackets.end());
+		}
+		/// No copy construction.
+		bracket_registry(const bracket_registry&) = delete;
+		/// No copy assignment.
+		bracket_registry &operator=(const bracket_registry&) = delete;
+		/// Unregisters from \ref interpretation::end_edit_interpret.
+		~bracket_registry() {
+			_interp->end_edit_interpret -= _mod_tok;
+		}
+
+		/// Returns the position of the bracket that matches the one at the given position. If there's no bracket
+		/// at the given position or the bracket is unmatched, returns an empty \p std::optional.
+		std::optional<std::size_t> find_matching_bracket(std::size_t pos) const {
+			std::size_t offset = pos;
+			_bracket_at_or_after_finder finder;
+			iterator it = _t.find_custom(finder, offset);
+			if (it == _t.end() || offset != it->offset) { // no bracket at the position
+				return std::nullopt;
+			}
+			std::ptrdiff_t depth = finder.depth;
+			if (it->opening) { // the first closing bracket after this one that returns to this depth
+				if (auto res = _find_first_after(_t.root(), 0, 0, pos + 1, depth)) {
+					return res->position;
+				}
+			} else { // the opening bracket after the last bracket before this one with a depth of this bracket
+				return _find_opening_bracket_before(pos, depth - 1);
+			}
+			return std::nullopt;
+		}
+		/// Returns the innermost block that contains the given position. A block contains a position if the
+		/// position is after its opening bracket, and before or at its closing bracket. If there's no such block,
+		/// or if the block is not closed, returns an empty \p std::optional.
+		std::optional<block> find_enclosing_block(std::size_t pos) const {
+			std::ptrdiff_t depth = _depth_before(pos) - 1;
+			auto close = _find_first_after(_t.root(), 0, 0, pos, depth);
+			if (!close) {
+				return std::nullopt;
+			}
+			if (auto open = _find_opening_bracket_before(pos, depth)) {
+				return block(open.value(), close->position);
+			}
+			return std::nullopt;
+		}
+		/// Returns all closed blocks whose opening brackets are in the given range, sorted by the positions of
+		/// their opening brackets. This can be used to generate fold regions.
+		std::vector<block> get_blocks(std::size_t beg, std::size_t end) const {
+			std::vector<block> result;
+			std::size_t offset = beg;
+			_bracket_at_or_after_finder finder;
+			iterator it = _t.find_custom(finder, offset);
+			std::ptrdiff_t depth = finder.depth;
+			for (std::size_t pos = beg - offset; it != _t.end(); ++it) {
+				pos += it->offset;
+				if (pos >= end) {
+					break;
+				}
+				if (it->opening) {
+					if (auto res = _find_first_after(_t.root(), 0, 0, pos + 1, depth)) {
+						result.emplace_back(pos, res->position);
+					}
+				}
+				depth += it->opening ? 1 : -1;
+			}
+			return result;
+		}
+		/// Returns all closed blocks whose opening brackets are in the given range and that are not inside
+		/// another returned block, sorted by the positions of their opening brackets. Brackets inside a returned
+		/// block are skipped altogether, so this is much cheaper than \ref get_blocks() for the whole document.
+		std::vector<block> get_outermost_blocks(std::size_t beg, std::size_t end) const {
+			std::vector<block> result;
+			std::size_t offset = beg;
+			_bracket_at_or_after_finder finder;
+			iterator it = _t.find_custom(finder, offset);
+			std::ptrdiff_t depth = finder.depth;
+			for (std::size_t pos = beg - offset; it != _t.end(); ) {
+				pos += it->offset;
+				if (pos >= end) {
+					break;
+				}
+				if (it->opening) {
+					if (auto res = _find_first_after(_t.root(), 0, 0, pos + 1, depth)) {
+						result.emplace_back(pos, res->position);
+						// jump to the first bracket after the block; the depth there is the same as before it
+						offset = res->position + 1;
+						it = _t.find_custom(_bracket_at_or_after_finder(), offset);
+						pos = res->position + 1 - offset;
+						continue;
+					}
+				}
+				depth += it->opening ? 1 : -1;
+				++it;
+			}
+			return result;
+		}
+
+		/// Returns the total number of brackets.
+		std::size_t num_brackets() const {
+			return _t.root() == nullptr ? 0 : _t.root()->synth_data.num_brackets;
+		}
+		/// Returns the associated \ref interpretation.
+		const std::shared_ptr<interpretation> &get_interpretation() const {
+			return _interp;
+		}
+	protected:
+		/// A single bracket.
+		struct bracket_data {
+			/// Default constructor.
+			bracket_data() = default;
+			/// Initializes all fields of this struct.
+			bracket_data(std::size_t off, std::size_t ty, bool open) : offset(off), type(ty), opening(open) {
+			}
+
+			/// The distance between the previous bracket (or the beginning of the document if this is the first
+			/// bracket) and this one.
+			std::size_t offset = 0;
+			std::size_t type = 0; ///< The index of this bracket's pair in \ref _pairs.
+			bool opening = false; ///< Whether this is an opening bracket.
+		};
+		/// Contains additional synthesized data of a subtree.
+		struct bracket_synth_data {
+			/// A node in the tree.
+			using node_type = binary_tree_node<bracket_data, bracket_synth_data>;
+			/// Returns the change of depth caused by the bracket.
+			struct get_node_depth_delta {
+				/// Returns 1 for opening brackets, and -1 for closing brackets.
+				inline static std::ptrdiff_t get(const node_type &n) {
+					return n.value.opening ? 1 : -1;
+				}
+			};
+
+			std::size_t
+				total_offset = 0, ///< The sum of \ref bracket_data::offset of all brackets in this subtree.
+				num_brackets = 0; ///< The number of brackets in this subtree.
+			std::ptrdiff_t
+				total_depth = 0, ///< The total change of depth caused by all brackets in this subtree.
+				/// The minimum depth after any bracket in this subtree, relative to the depth before the subtree.
+				min_depth = 0;
+
+			using offset_property = sum_synthesizer::compact_property<
+				synthesization_helper::field_value_property<&bracket_data::offset>,
+				&bracket_synth_data::total_offset
+			>; ///< Property used to obtain the positions of brackets.
+			using num_brackets_property = sum_synthesizer::compact_property<
+				synthesization_helper::identity, &bracket_synth_data::num_brackets
+			>; ///< Property used to obtain the number of brackets.
+			using depth_property = sum_synthesizer::compact_property<
+				get_node_depth_delta, &bracket_synth_data::total_depth
+			>; ///< Property used to obtain the depth after a bracket.
+
+			/// Calls \ref sum_synthesizer::synthesize to update the stored values, then updates \ref min_depth.
+			inline static void synthesize(node_type &n) {
+				sum_synthesizer::synthesize<offset_property, num_brackets_property, depth_property>(n);
+				std::ptrdiff_t depth = get_node_depth_delta::get(n);
+				if (n.left) {
+					depth += n.left->synth_data.total_depth;
+				}
+				n.synth_data.min_depth = depth;
+				if (n.left) {
+					n.synth_data.min_depth = std::min(n.synth_data.min_depth, n.left->synth_data.min_depth);
+				}
+				if (n.right) {
+					n.synth_data.min_depth = std::min(n.synth_data.min_depth, depth + n.right->synth_data.min_depth);
+				}
+			}
+		};
+		/// The type of the tree used to store brackets.
+		using tree_type = binary_tree<bracket_data, bracket_synth_data>;
+		using node_type = tree_type::node; ///< The type of a node in \ref tree_type.
+		using iterator = tree_type::const_iterator; ///< Iterator through the brackets.
+
+		/// Used to find the first bracket at or after the given position, and the depth before it.
+		struct _bracket_at_or_after_finder {
+			/// The underlying \ref sum_synthesizer::index_finder.
+			using finder = sum_synthesizer::index_finder<
+				bracket_synth_data::offset_property, false, std::less_equal<std::size_t>
+			>;
+			/// Interface for \ref binary_tree::find_custom().
+			int select_find(const node_type &n, std::size_t &pos) {
+				return finder::template select_find<bracket_synth_data::depth_property>(n, pos, depth);
+			}
+			std::ptrdiff_t depth = 0; ///< Records the total change of depth caused by all brackets before it.
+		};
+		/// The result of searching for a bracket.
+		struct _search_result {
+			/// Default constructor.
+			_search_result() = default;
+			/// Initializes all fields of this struct.
+			_search_result(std::size_t pos, std::ptrdiff_t d) : position(pos), depth(d) {
+			}
+
+			std::size_t position = 0; ///< The position of the bracket.
+			std::ptrdiff_t depth = 0; ///< The depth after the bracket.
+		};
+
+		std::vector<bracket_pair> _pairs; ///< All pairs of brackets.
+		tree_type _t; ///< Brackets.
+		std::shared_ptr<interpretation> _interp; ///< The associated \ref interpretation.
+		info_event<buffer::end_edit_info>::token _mod_tok; ///< Used to listen to \ref interpretation::end_edit_interpret.
+
+		/// Returns the total change of depth caused by all brackets before the given position.
+		std::ptrdiff_t _depth_before(std::size_t pos) const {
+			_bracket_at_or_after_finder finder;
+			_t.find_custom(finder, pos);
+			return finder.depth;
+		}
+		/// Finds the first bracket in the given subtree that is at or after \p pos, after which the depth is less
+		/// than or equal to \p depth. Subtrees are skipped using \ref bracket_synth_data::min_depth.
+		///
+		/// \param n The root of the subtree.
+		/// \param prevpos The position of the bracket before the subtree.
+		/// \param prevdepth The depth before the subtree.
+		inline static std::optional<_search_result> _find_first_after(
+			const node_type *n, std::size_t prevpos, std::ptrdiff_t prevdepth, std::size_t pos, std::ptrdiff_t depth
+		) {
+			if (
+				n == nullptr ||
+				prevpos + n->synth_data.total_offset < pos ||
+				prevdepth + n->synth_data.min_depth > depth
+			) {
+				return std::nullopt;
+			}
+			if (auto res = _find_first_after(n->left, prevpos, prevdepth, pos, depth)) {
+				return res;
+			}
+			std::size_t npos = prevpos + n->value.offset;
+			std::ptrdiff_t ndepth = prevdepth + bracket_synth_data::get_node_depth_delta::get(*n);
+			if (n->left) {
+				npos += n->left->synth_data.total_offset;
+				ndepth += n->left->synth_data.total_depth;
+			}
+			if (npos >= pos && ndepth <= depth) {
+				return _search_result(npos, ndepth);
+			}
+			return _find_first_after(n->right, npos, ndepth, pos, depth);
+		}
+		/// Finds the last bracket in the given subtree that is before \p pos, after which the depth is less than
+		/// or equal to \p depth. Subtrees are skipped using \ref bracket_synth_data::min_depth.
+		///
+		/// \param n The root of the subtree.
+		/// \param prevpos The position of the bracket before the subtree.
+		/// \param prevdepth The depth before the subtree.
+		inline static std::optional<_search_result> _find_last_before(
+			const node_type *n, std::size_t prevpos, std::ptrdiff_t prevdepth, std::size_t pos, std::ptrdiff_t depth
+		) {
+			// all brackets in the subtree are after prevpos, except for a bracket at the very beginning
+			if (n == nullptr || prevpos >= pos || prevdepth + n->synth_data.min_depth > depth) {
+				return std::nullopt;
+			}
+			std::size_t npos = prevpos + n->value.offset;
+			std::ptrdiff_t ndepth = prevdepth + bracket_synth_data::get_node_depth_delta::get(*n);
+			if (n->left) {
+				npos += n->left->synth_data.total_offset;
+				ndepth += n->left->synth_data.total_depth;
+			}
+			if (auto res = _find_last_before(n->right, npos, ndepth, pos, depth)) {
+				return res;
+			}
+			if (npos < pos && ndepth <= depth) {
+				return _search_result(npos, ndepth);
+			}
+			return _find_last_before(n->left, prevpos, prevdepth, pos, depth);
+		}
+		/// Finds the opening bracket before \p pos whose depth before it is \p depth, and after which the depth
+		/// never drops to \p depth before \p pos. This is the bracket immediately after the last bracket before
+		/// \p pos whose depth after it is less than or equal to \p depth.
+		std::optional<std::size_t> _find_opening_bracket_before(std::size_t pos, std::ptrdiff_t depth) const {
+			std::size_t target = 0;
+			if (auto res = _find_last_before(_t.root(), 0, 0, pos, depth)) {
+				if (res->depth != depth) {
+					return std::nullopt;
+				}
+				target = res->position + 1;
+			} else if (depth != 0) { // the depth before the first bracket is 0
+				return std::nullopt;
+			}
+			std::size_t offset = target;
+			iterator it = _t.find_custom(_bracket_at_or_after_finder(), offset);
+			if (it == _t.end()) {
+				return std::nullopt;
+			}
+			std::size_t result = target - offset + it->offset;
+			if (result >= pos) {
+				return std::nullopt;
+			}
+			return result;
+		}
+
+		/// Scans the given range of characters for brackets, and appends them to \p brackets.
+		///
+		/// \param beg The first character in the range.
+		/// \param end The character past the end of the range.
+		/// \param last The position of the last bracket before this range, or 0. This will be updated to the
+		///             position of the last bracket that has been found.
+		/// \param brackets Found brackets will be appended to this list.
+		void _scan(std::size_t beg, std::size_t end, std::size_t &last, std::vector<bracket_data> &brackets) const {
+			interpretation::character_iterator cit = _interp->at_character(beg);
+			for (std::size_t pos = beg; pos < end; ++pos, cit.next()) {
+				if (cit.is_linebreak() || !cit.codepoint().is_codepoint_valid()) {
+					continue;
+				}
+				codepoint cp = cit.codepoint().get_codepoint();
+				for (std::size_t i = 0; i < _pairs.size(); ++i) {
+					if (cp == _pairs[i].first || cp == _pairs[i].second) {
+						brackets.emplace_back(pos - last, i, cp == _pairs[i].first);
+						last = pos;
+						break;
+					}
+				}
+			}
+		}
+
+		/// Called when \ref interpretation::end_edit_interpret is invoked. For each modification, removes all
+		/// brackets in the removed range, scans the inserted characters for new brackets, and shifts all
+		/// following brackets.
+		void _on_end_edit() {
+			for (const interpretation::character_modification &mod : _interp->get_character_modifications()) {
+				if (mod.removed_chars == 0 && mod.added_chars == 0) {
+					continue;
+				}
+				// find all brackets in the removed range
+				std::size_t
+					lower_offset = mod.position,
+					upper_offset = mod.position + mod.removed_chars;
+				iterator
+					lower = _t.find_custom(_bracket_at_or_after_finder(), lower_offset),
+					upper = _t.find_custom(_bracket_at_or_after_finder(), upper_offset);
+				std::size_t
+					last = mod.position - lower_offset,
+					upperpos = mod.position + mod.removed_chars - upper_offset;
+				if (upper != _t.end()) {
+					upperpos += upper->offset;
+				}
+				// since modifications are sorted, the inserted characters won't be modified again
+				std::vector<bracket_data> brackets;
+				_scan(mod.position, mod.position + mod.added_chars, last, brackets);
+				_t.erase(lower, upper);
+				_t.insert_range_before_move(upper, brackets.begin(), brackets.end());
+				if (upper != _t.end()) {
+					auto upmod = _t.get_modifier_for(upper.get_node());
+					upmod->offset = upperpos + mod.added_chars - mod.removed_chars - last;
+				}
+			}
+		}
+	};
+}
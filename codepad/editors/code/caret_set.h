@@ -20,6 +20,9 @@ namespace codepad::editors::code {
 		}
 
 		double alignment = 0.0; ///< The alignment of the caret when it moves vertically.
+		/// Indicates whether \ref alignment is up-to-date. If not, it will be calculated when the caret becomes
+		/// visible, or when the caret is moved vertically.
+		bool alignment_valid = true;
 		/// Only used when the caret is positioned at a soft linebreak, to determine which line it's on.
 		/// \p false if it's on the former line, and \p true if it's on the latter.
 		bool after_stall = false;
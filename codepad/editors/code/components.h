@@ -20,7 +20,7 @@ namespace codepad::editors::code {
 				for (; ln > 0; ++w, ln /= 10) {
 				}
 				// TODO customizable font parameters
-				auto font = edt->get_font_families()[0]->get_matching_font(
+				auto font = edt->get_font_families()[0]->get_matching_font_shared(
 					ui::font_style::normal, ui::font_weight::normal, ui::font_stretch::normal
 				);
 				double maxw = edt->get_font_size() * font->get_maximum_character_width_em(
@@ -36,8 +36,56 @@ namespace codepad::editors::code {
 			return CP_STRLIT("line_number_display");
 		}
 	protected:
+		/// Cached renderings of all digits, used to compose line numbers without formatting and shaping them for
+		/// every line.
+		struct _digit_cache {
+			std::array<std::unique_ptr<ui::plain_text>, 10> digits; ///< Renderings of digits 0 to 9.
+			std::shared_ptr<ui::font> font; ///< The font used to render \ref digits.
+			double
+				font_size = 0.0, ///< The font size used to render \ref digits.
+				/// The horizontal distance between two consecutive digits, which is the width of the widest digit.
+				advance = 0.0;
+		};
+
+		mutable _digit_cache _digits; ///< Cached renderings of all digits.
 		bool _events_registered = false; ///< Indicates whether the events has been registered.
 
+		/// Returns \ref _digits, updating it first if the font or the font size has changed.
+		const _digit_cache &_get_digits(ui::renderer_base &r, std::shared_ptr<ui::font> font, double size) const {
+			if (_digits.font != font || _digits.font_size != size) {
+				_digits.font = std::move(font);
+				_digits.font_size = size;
+				_digits.advance = 0.0;
+				for (std::size_t i = 0; i < _digits.digits.size(); ++i) {
+					codepoint digit = static_cast<codepoint>('0' + i);
+					_digits.digits[i] = r.create_plain_text(
+						std::basic_string_view<codepoint>(&digit, 1), *_digits.font, size
+					);
+					_digits.advance = std::max(_digits.advance, _digits.digits[i]->get_width());
+				}
+			}
+			return _digits;
+		}
+		/// Renders the given number using \ref _digit_cache::digits. Each digit is centered in a cell as wide as
+		/// \ref _digit_cache::advance, and the number is aligned to the right.
+		///
+		/// \param r The renderer.
+		/// \param digits The digits.
+		/// \param number The number to render.
+		/// \param topright The top right corner of the number.
+		inline static void _render_number(
+			ui::renderer_base &r, const _digit_cache &digits, std::size_t number, vec2d topright
+		) {
+			double x = topright.x;
+			do {
+				ui::plain_text &text = *digits.digits[number % 10];
+				x -= digits.advance;
+				double left = x + 0.5 * (digits.advance - text.get_width());
+				r.draw_plain_text(text, vec2d(left, topright.y), colord()); // TODO customizable color
+				number /= 10;
+			} while (number > 0);
+		}
+
 		/// Registers events if a \ref contents_region can be found.
 		void _register_handlers() {
 			if (!_events_registered) {
@@ -62,7 +110,9 @@ namespace codepad::editors::code {
 			_register_handlers();
 		}
 
-		/// Renders all visible line numbers.
+		/// Renders all visible line numbers. Line numbers are computed by counting hard linebreaks while iterating
+		/// through visual lines; they're only looked up in the \ref linebreak_registry for the first line and
+		/// after folded regions.
 		void _custom_render() const override {
 			element::_custom_render();
 
@@ -79,10 +129,11 @@ namespace codepad::editors::code {
 				double cury = static_cast<double>(fline) * lh - ybeg, width = client.width() + get_padding().left;
 
 				auto &renderer = get_manager().get_renderer();
-				auto font = edt->get_font_families()[0]->get_matching_font(
+				auto font = edt->get_font_families()[0]->get_matching_font_shared(
 					ui::font_style::normal, ui::font_weight::normal, ui::font_stretch::normal
 				);
 				double baseline_correction = edt->get_baseline() - font->get_ascent_em() * edt->get_font_size();
+				const _digit_cache &digits = _get_digits(renderer, std::move(font), edt->get_font_size());
 
 				{
 					ui::pixel_snapped_render_target buffer(
@@ -91,18 +142,25 @@ namespace codepad::editors::code {
 						get_window()->get_scaling_factor()
 					);
 
-					for (std::size_t curi = fline; curi < eline; ++curi, cury += lh) {
-						std::size_t line = fmt.get_folding().folded_to_unfolded_line_number(curi);
-						auto lineinfo = fmt.get_linebreaks().get_line_info(line);
-						if (lineinfo.first.entry == edt->get_document()->get_linebreaks().end()) {
-							break; // when after the end of the document
+					const visual_line_registry &vislines = fmt.get_visual_lines();
+					const linebreak_registry &hardlines = edt->get_document()->get_linebreaks();
+					visual_line_registry::line_info lineinfo = vislines.get_line_info(fline);
+					std::size_t line = 0; // the index of the last line whose number has been rendered
+					bool line_known = false; // whether hard linebreaks since that line are all counted
+					for (
+						std::size_t curi = fline;
+						curi < eline && lineinfo.entry != vislines.end(); // stop when after the end of the document
+						++curi, cury += lh, lineinfo.first_char += lineinfo.entry->length, ++lineinfo.entry
+						) {
+						if (lineinfo.entry->type == linebreak_type::hard) { // ignore soft linebreaks
+							line = line_known ? line + 1 : hardlines.get_line_and_column_of_char(
+								lineinfo.first_char
+							).line;
+							line_known = true;
+							_render_number(renderer, digits, 1 + line, vec2d(width, cury + baseline_correction));
 						}
-						if (lineinfo.first.first_char >= lineinfo.second.prev_chars) { // ignore soft linebreaks
-							str_t curlbl = std::to_string(1 + line - lineinfo.second.prev_softbreaks);
-							auto text = renderer.create_plain_text(curlbl, *font, edt->get_font_size());
-							double w = text->get_width();
-							// TODO customizable color
-							renderer.draw_plain_text(*text, vec2d(width - w, cury + baseline_correction), colord());
+						if (lineinfo.entry->unfolded_lines > 1) { // folded regions may contain hard linebreaks
+							line_known = false;
 						}
 					}
 				}
@@ -113,9 +171,23 @@ namespace codepad::editors::code {
 	/// Displays a minimap of the code, similar to that of sublime text.
 	class minimap : public ui::element {
 	public:
+		/// Determines how the text in pages is rendered.
+		enum class page_rendering_mode : unsigned char {
+			text, ///< Text is shaped and rendered in the same way as in the \ref contents_region.
+			blocks, ///< Text is rendered as blocks of solid color by \ref fragment_block_renderer.
+			/// Uses \ref page_rendering_mode::blocks for documents with at least
+			/// \ref block_rendering_line_threshold lines, and \ref page_rendering_mode::text otherwise.
+			automatic
+		};
+
 		/// The maximum amount of time allowed for rendering a page (i.e., an entry of \ref _page_cache).
 		constexpr static std::chrono::duration<double> page_rendering_time_redline{ 0.03 };
+		/// The amount of time spent rendering pages before each frame. Pages that are not rendered within this
+		/// time are rendered in later frames.
+		constexpr static std::chrono::duration<double> page_rendering_time_slice{ 0.008 };
 		constexpr static std::size_t minimum_page_size = 500; /// Maximum height of a page, in pixels.
+		/// The number of lines starting from which \ref page_rendering_mode::automatic renders blocks.
+		constexpr static std::size_t block_rendering_line_threshold = 20000;
 
 		/// Returns the default width, which is proportional to that of the \ref contents_region.
 		ui::size_allocation get_desired_width() const override {
@@ -138,6 +210,14 @@ namespace codepad::editors::code {
 		inline static double get_target_line_height() {
 			return _target_height;
 		}
+		/// Sets how the text in minimaps is rendered. This only affects pages rendered afterwards.
+		inline static void set_page_rendering_mode(page_rendering_mode mode) {
+			_rendering_mode = mode;
+		}
+		/// Returns how the text in minimaps is rendered.
+		inline static page_rendering_mode get_page_rendering_mode() {
+			return _rendering_mode;
+		}
 
 		/// Returns the default class of elements of type \ref minimap.
 		inline static str_t get_default_class() {
@@ -148,7 +228,10 @@ namespace codepad::editors::code {
 			return CP_STRLIT("minimap_viewport");
 		}
 	protected:
-		/// Caches rendered pages so it won't be necessary to render large pages of text frequently.
+		/// Caches rendered pages so it won't be necessary to render large pages of text frequently. Pages are
+		/// rendered in time slices before each frame, starting from the visible ones, so that large documents never
+		/// block the UI. Pages that have not been rendered are displayed as placeholders, and pages affected by
+		/// changes are kept and displayed until they're re-rendered.
 		struct _page_cache {
 			constexpr static double
 				minimum_width = 50, ///< The minimum width of a page.
@@ -158,23 +241,48 @@ namespace codepad::editors::code {
 				/// actual width.
 				shirnk_threshold = 0.5;
 
+			/// A cached page.
+			struct page {
+				/// The rendered page. \ref ui::render_target_data::target is \p nullptr if this page has not been
+				/// rendered yet.
+				ui::render_target_data surface;
+				/// Indicates that this page has been affected by changes since it was rendered. Stale pages are still
+				/// displayed until they're re-rendered.
+				bool stale = false;
+
+				/// Returns whether this page needs to be rendered or re-rendered.
+				bool needs_rendering() const {
+					return stale || surface.target == nullptr;
+				}
+			};
+			/// The type of \ref pages.
+			using page_map = std::map<std::size_t, page>;
+			/// The type of the deadline used when rendering pages in time slices.
+			using deadline = std::chrono::time_point<performance_monitor::clock_t, std::chrono::duration<double>>;
+
 			/// Constructor. Sets the associated \ref minimap of this cache.
 			explicit _page_cache(minimap &p) : _parent(&p) {
 			}
 
-			/// Clears all cached pages, and re-renders the currently visible page immediately. To render this page
-			/// on demand, simply clear \ref pages and call \ref invalidate().
-			void restart() {
+			/// Returns all cached pages to the \ref ui::render_target_pool of the renderer, and clears \ref pages.
+			void clear_pages() {
+				ui::render_target_pool &pool = _parent->get_manager().get_renderer().get_render_target_pool();
+				for (auto &pg : pages) {
+					pool.release(std::move(pg.second.surface));
+				}
 				pages.clear();
+			}
+			/// Clears all cached pages, and adds a single page that covers the currently visible lines. The page is
+			/// rendered by \ref prepare().
+			void restart() {
+				clear_pages();
 				if (contents_region *edt = component_helper::get_contents_region(*_parent)) {
 					std::pair<std::size_t, std::size_t> be = _parent->_get_visible_visual_lines();
-					double slh = edt->get_line_height() * _parent->get_scale();
 					std::size_t
 						numlines = edt->get_num_visual_lines(),
-						pgsize = std::max(
-							be.second - be.first, static_cast<std::size_t>(minimum_page_size / slh) + 1
-						),
+						pgsize = std::max(be.second - be.first, _get_minimum_page_lines(*edt)),
 						page_beg = 0;
+					_num_lines = numlines;
 					_page_end = numlines;
 					if (pgsize < numlines) { // the viewport is smaller than one page
 						if (be.first + be.second < pgsize) { // at the top
@@ -186,57 +294,90 @@ namespace codepad::editors::code {
 							_page_end = page_beg + pgsize;
 						}
 					}
-					_render_page(page_beg, _page_end); // render the visible page
+					pages.try_emplace(page_beg);
 				}
 			}
-			/// Ensures that all visible pages have been rendered. If \ref pages is empty, calls \ref restart;
-			/// otherwise checks if new pages need to be rendered.
+			/// Ensures that all visible lines are covered by \ref pages, then renders pages that need to be rendered
+			/// for at most \ref page_rendering_time_slice, starting from the visible ones. If there are still pages
+			/// left, schedules the \ref minimap to be updated so that they're rendered in later frames.
 			void prepare() {
-				if (_ready) {
-					return;
+				if (!_ready) {
+					_update_page_layout();
+					_ready = true;
 				}
-				if (pages.empty()) {
-					restart();
-				} else {
-					if (contents_region *edt = component_helper::get_contents_region(*_parent)) {
-						std::pair<std::size_t, std::size_t> be = _parent->_get_visible_visual_lines();
-						std::size_t page_beg = pages.begin()->first;
-						if (be.first >= page_beg && be.second <= _page_end) { // all are visible
-							return;
-						}
-						std::size_t min_page_lines = static_cast<std::size_t>(
-							minimum_page_size / (edt->get_line_height() * _parent->get_scale())
-							) + 1,
-							// the number of lines in the page about to be rendered
-							page_lines = std::max(be.second - be.first, min_page_lines);
-						if (be.first + page_lines < page_beg || _page_end + page_lines < be.second) {
-							// too far away from already rendered region, reset cache
-							restart();
-						} else {
-							if (be.first < page_beg) { // render one page before the first one
-								// if the page before is not large enough, make it as large as min_page_lines
-								std::size_t frontline = std::max(page_beg, min_page_lines) - min_page_lines;
-								// at least the first visible line is rendered
-								_render_page(std::min(be.first, frontline), page_beg);
-							}
-							if (be.second > _page_end) { // render one page after the last one
-								// if not large enough, make it as large as min_page_lines
-								std::size_t backline = std::min(edt->get_num_visual_lines(), _page_end + min_page_lines);
-								// at least the last visible line is rendered
-								backline = std::max(be.second, backline);
-								_render_page(_page_end, backline);
-								_page_end = backline; // set _page_end
-							}
-						}
-					}
+				if (_render_pending_pages(performance_monitor::clock_t::now() + page_rendering_time_slice)) {
+					_parent->get_manager().get_scheduler().schedule_element_update(*_parent);
 				}
-				_ready = true;
 			}
 			/// Marks this cache as not ready so that it'll be updated next time \ref prepare() is called.
 			void invalidate() {
 				_ready = false;
 			}
 
+			/// Marks all pages as stale, and discards pages that are past the end of the document. This is called
+			/// when the visual of the document has changed in ways that cannot be tracked line by line.
+			void on_visual_changed(const contents_region &edt) {
+				for (auto &pg : pages) {
+					pg.second.stale = true;
+				}
+				_on_num_lines_changed(edt.get_num_visual_lines());
+			}
+			/// Updates \ref pages after the document has been edited. Pages after each modification are moved by the
+			/// number of inserted or removed lines, pages that contain modified lines are marked as stale, and pages
+			/// that only contain removed lines are discarded. If the number of visual lines does not match the
+			/// modifications, e.g., because of word wrapping, all pages are marked as stale.
+			void on_edit(const contents_region &edt) {
+				if (pages.empty()) {
+					return;
+				}
+				ui::render_target_pool &pool = _parent->get_manager().get_renderer().get_render_target_pool();
+				const visual_line_registry &vislines = edt.get_formatting().get_visual_lines();
+				std::ptrdiff_t total_diff = 0;
+				const std::vector<interpretation::character_modification> &mods =
+					edt.get_document()->get_character_modifications();
+				for (const interpretation::character_modification &mod : mods) {
+					std::ptrdiff_t diff =
+						static_cast<std::ptrdiff_t>(mod.added_linebreaks) -
+						static_cast<std::ptrdiff_t>(mod.removed_linebreaks);
+					total_diff += diff;
+					// later modifications are after this one, so this is also the line before the modification
+					std::size_t line = vislines.get_visual_line_of_char(mod.position);
+					if (line >= _page_end || pages.empty()) {
+						continue;
+					}
+					std::size_t removed_end = line + mod.removed_linebreaks;
+					auto it = pages.upper_bound(line);
+					if (it != pages.begin()) {
+						std::prev(it)->second.stale = true; // the page that contains the modification
+					}
+					// pages that start within the removed lines are merged into the previous page
+					for (; it != pages.end() && it->first <= removed_end; it = pages.erase(it)) {
+						pool.release(std::move(it->second.surface));
+					}
+					if (diff != 0) {
+						page_map moved;
+						while (it != pages.end()) {
+							auto node = pages.extract(it++);
+							node.key() = static_cast<std::size_t>(static_cast<std::ptrdiff_t>(node.key()) + diff);
+							moved.insert(std::move(node));
+						}
+						pages.merge(moved);
+					}
+					if (_page_end > removed_end) {
+						_page_end = static_cast<std::size_t>(static_cast<std::ptrdiff_t>(_page_end) + diff);
+					} else {
+						_page_end = line + mod.added_linebreaks + 1;
+					}
+				}
+				std::size_t numlines = edt.get_num_visual_lines();
+				if (static_cast<std::ptrdiff_t>(numlines) - static_cast<std::ptrdiff_t>(_num_lines) != total_diff) {
+					for (auto &pg : pages) { // soft linebreaks or folded regions have changed
+						pg.second.stale = true;
+					}
+				}
+				_on_num_lines_changed(numlines);
+			}
+
 			/// Called when the width of the \ref minimap has changed to update \ref _width.
 			void on_width_changed(double w) {
 				if (w > _width) {
@@ -244,7 +385,7 @@ namespace codepad::editors::code {
 						_width = _width * enlarge_factor;
 					} while (w > _width);
 					logger::get().log_debug(CP_HERE) << "minimap width extended to " << _width;
-					pages.clear();
+					clear_pages();
 					invalidate();
 				} else if (_width > minimum_width && w < shirnk_threshold * _width) {
 					_width = std::max(minimum_width, w);
@@ -252,84 +393,221 @@ namespace codepad::editors::code {
 				}
 			}
 
-			/// The cached pages. The keys are the indices of each page's first line, and the values are
-			/// corresponding \ref ui::render_target_data.
-			std::map<std::size_t, ui::render_target_data> pages;
+			/// Returns the index past the last line of the given page, which is either the first line of the next
+			/// page, or \ref _page_end for the last page.
+			std::size_t get_page_end(page_map::const_iterator it) const {
+				++it;
+				return it == pages.end() ? _page_end : it->first;
+			}
+
+			/// The cached pages. The keys are the indices of each page's first line. Pages are consecutive, and the
+			/// last page ends at \ref _page_end.
+			page_map pages;
 		protected:
-			/// The index past the end of the range of lines that has been rendered and stored in \ref pages.
+			/// The index past the end of the range of lines that are covered by \ref pages.
 			std::size_t _page_end = 0;
+			/// The number of visual lines in the document when \ref pages was last updated.
+			std::size_t _num_lines = 0;
 			double _width = minimum_width; ///< The width of all pages.
 			minimap *_parent = nullptr; ///< The associated \ref minimap.
-			/// Marks whether this cache is ready for rendering the currently visible portion of the document.
+			/// Marks whether \ref pages covers the currently visible portion of the document.
 			bool _ready = false;
 
-			/// Renders the page specified by the range of lines, and inserts the result into \ref pages. Note that
-			/// this function does not automatically set \ref _page_end.
+			/// Returns the minimum number of lines in a page.
+			std::size_t _get_minimum_page_lines(const contents_region &edt) const {
+				return static_cast<std::size_t>(minimum_page_size / (edt.get_line_height() * _parent->get_scale())) + 1;
+			}
+
+			/// Updates \ref _num_lines, and discards pages that are past the end of the document.
+			void _on_num_lines_changed(std::size_t numlines) {
+				ui::render_target_pool &pool = _parent->get_manager().get_renderer().get_render_target_pool();
+				_num_lines = numlines;
+				_page_end = std::min(_page_end, numlines);
+				while (!pages.empty() && std::prev(pages.end())->first >= _page_end) {
+					auto last = std::prev(pages.end());
+					pool.release(std::move(last->second.surface));
+					pages.erase(last);
+				}
+			}
+
+			/// Adds pages so that all visible lines are covered by \ref pages. If \ref pages is empty or far away
+			/// from the visible lines, calls \ref restart().
+			void _update_page_layout() {
+				if (pages.empty()) {
+					restart();
+					return;
+				}
+				if (contents_region *edt = component_helper::get_contents_region(*_parent)) {
+					std::pair<std::size_t, std::size_t> be = _parent->_get_visible_visual_lines();
+					std::size_t page_beg = pages.begin()->first;
+					if (be.first >= page_beg && be.second <= _page_end) { // all are visible
+						return;
+					}
+					std::size_t
+						min_page_lines = _get_minimum_page_lines(*edt),
+						// the number of lines in the page about to be added
+						page_lines = std::max(be.second - be.first, min_page_lines);
+					if (be.first + page_lines < page_beg || _page_end + page_lines < be.second) {
+						// too far away from already covered region, reset cache
+						restart();
+					} else {
+						if (be.first < page_beg) { // add one page before the first one
+							// if the page before is not large enough, make it as large as min_page_lines
+							std::size_t frontline = std::max(page_beg, min_page_lines) - min_page_lines;
+							// at least the first visible line is covered
+							pages.try_emplace(std::min(be.first, frontline));
+						}
+						if (be.second > _page_end) { // add one page after the last one
+							// if not large enough, make it as large as min_page_lines
+							std::size_t backline = std::min(edt->get_num_visual_lines(), _page_end + min_page_lines);
+							// at least the last visible line is covered
+							backline = std::max(be.second, backline);
+							pages.try_emplace(_page_end);
+							_page_end = backline; // set _page_end
+						}
+					}
+				}
+			}
+			/// Renders pages that need to be rendered until all pages have been rendered or \p until has been
+			/// reached. Visible pages and pages after them are rendered first, followed by pages before them.
+			///
+			/// \return Whether there may still be pages that need to be rendered.
+			bool _render_pending_pages(deadline until) {
+				contents_region *edt = component_helper::get_contents_region(*_parent);
+				if (edt == nullptr || pages.empty()) {
+					return false;
+				}
+				// pages that have grown too large due to edits are split
+				std::size_t min_page_lines = _get_minimum_page_lines(*edt), max_page_lines = 2 * min_page_lines;
+				auto visible = pages.upper_bound(_parent->_get_visible_visual_lines().first);
+				if (visible != pages.begin()) {
+					--visible;
+				}
+				auto render = [&](page_map::iterator it) {
+					if (!it->second.needs_rendering()) {
+						return false;
+					}
+					std::size_t pe = get_page_end(it);
+					if (pe - it->first > max_page_lines) {
+						pe = it->first + min_page_lines;
+						pages.try_emplace(pe);
+					}
+					return !_render_page(it, pe) || performance_monitor::clock_t::now() >= until;
+				};
+				for (auto it = visible; it != pages.end(); ++it) {
+					if (render(it)) {
+						return true;
+					}
+				}
+				for (auto it = pages.begin(); it != visible; ++it) {
+					if (render(it)) {
+						return true;
+					}
+				}
+				return false;
+			}
+			/// Returns whether pages should be rendered using a \ref fragment_block_renderer.
+			static bool _use_blocks(const contents_region &edt) {
+				switch (_rendering_mode) {
+				case page_rendering_mode::text:
+					return false;
+				case page_rendering_mode::blocks:
+					return true;
+				default:
+					return edt.get_num_visual_lines() >= block_rendering_line_threshold;
+				}
+			}
+			/// Generates all fragments in the given range of visual lines, lays them out using the given assembler,
+			/// and passes them to the given function. Lines wider than a page are cut off.
 			///
-			/// \param s Index of the first visual line of the page.
+			/// \param edt The \ref contents_region.
+			/// \param s Index of the first visual line.
+			/// \param pe Index past the last visual line.
+			/// \param ass The assembler, either a \ref fragment_assembler or a \ref fragment_block_renderer.
+			/// \param append Called with each \ref fragment to append it to \p ass.
+			template <typename Assembler, typename Append> void _render_fragments(
+				const contents_region &edt, std::size_t s, std::size_t pe, Assembler &ass, Append &&append
+			) const {
+				const view_formatting &fmt = edt.get_formatting();
+				double maxx = _width / _parent->get_scale();
+				std::size_t
+					curvisline = s,
+					firstchar = fmt.get_visual_lines().get_beginning_char_of_visual_line(s).first,
+					plastchar = fmt.get_visual_lines().get_beginning_char_of_visual_line(pe).first;
+
+				fragment_generator<fragment_generator_component_hub<
+					soft_linebreak_inserter, folded_region_skipper
+					>> gen(
+						*edt.get_document(), edt.get_font_families(), firstchar,
+						soft_linebreak_inserter(fmt.get_linebreaks(), firstchar),
+						folded_region_skipper(fmt.get_folding(), firstchar)
+					);
+				while (gen.get_position() < plastchar) {
+					fragment_generation_result tok = gen.generate_and_update();
+					append(tok.result);
+					if (std::holds_alternative<linebreak_fragment>(tok.result)) {
+						++curvisline;
+					} else if (ass.get_horizontal_position() > maxx) {
+						++curvisline;
+						std::size_t
+							pos = fmt.get_visual_lines().get_beginning_char_of_visual_line(curvisline).first;
+						gen.reposition(pos);
+						ass.advance_vertical_position(1);
+						ass.set_horizontal_position(0.0);
+					}
+				}
+			}
+			/// Renders the given page and replaces its contents. The previous surface of the page is returned to
+			/// the \ref ui::render_target_pool.
+			///
+			/// \param pg The page. Its key is the index of the first visual line of the page.
 			/// \param pe Index past the last visual line of the page.
-			void _render_page(std::size_t s, std::size_t pe) {
+			/// \return \p false if the page cannot be rendered at the moment.
+			bool _render_page(page_map::iterator pg, std::size_t pe) {
 				ui::window_base *wnd = _parent->get_window();
 				if (wnd == nullptr) { // we need the scale factor from the window
-					return;
+					return false;
 				}
 
 				performance_monitor mon(CP_STRLIT("render_minimap_page"), page_rendering_time_redline);
 				if (contents_region *edt = component_helper::get_contents_region(*_parent)) {
+					std::size_t s = pg->first;
 					double lh = edt->get_line_height(), scale = _parent->get_scale();
 
 					ui::renderer_base &r = _parent->get_manager().get_renderer();
-					ui::render_target_data rt = r.create_render_target(
+					ui::render_target_data rt = r.get_render_target_pool().acquire(
 						vec2d( // add 1 because the starting position was floored instead of rounded
 							_width, std::ceil(lh * scale * static_cast<double>(pe - s)) + 1
 						),
 						wnd->get_scaling_factor()
 					);
 
-					const view_formatting &fmt = edt->get_formatting();
-					std::size_t
-						curvisline = s,
-						firstchar = fmt.get_linebreaks().get_beginning_char_of_visual_line(
-							fmt.get_folding().folded_to_unfolded_line_number(s)
-						).first,
-						plastchar = fmt.get_linebreaks().get_beginning_char_of_visual_line(
-							fmt.get_folding().folded_to_unfolded_line_number(pe)
-						).first;
-
-					fragment_generator<fragment_generator_component_hub<
-						soft_linebreak_inserter, folded_region_skipper
-						>> gen(
-							*edt->get_document(), edt->get_font_families(), firstchar,
-							soft_linebreak_inserter(fmt.get_linebreaks(), firstchar),
-							folded_region_skipper(fmt.get_folding(), firstchar)
-						);
-					fragment_assembler ass(*edt);
-
 					r.begin_drawing(*rt.target);
 					r.push_matrix_mult(matd3x3::scale(vec2d(0.0, 0.0), scale));
-					while (gen.get_position() < plastchar) {
-						fragment_generation_result tok = gen.generate_and_update();
-						std::visit([&ass, &r](auto &&frag) {
-							auto &&rendering = ass.append(frag);
-							ass.render(r, rendering);
-							}, tok.result);
-						if (std::holds_alternative<linebreak_fragment>(tok.result)) {
-							++curvisline;
-						} else if (ass.get_horizontal_position() > _width / scale) {
-							++curvisline;
-							std::size_t
-								pos = fmt.get_linebreaks().get_beginning_char_of_visual_line(
-									fmt.get_folding().folded_to_unfolded_line_number(curvisline)
-								).first;
-							gen.reposition(pos);
-							ass.advance_vertical_position(1);
-							ass.set_horizontal_position(0.0);
-						}
+					if (_use_blocks(*edt)) {
+						fragment_block_renderer blocks(*edt);
+						_render_fragments(*edt, s, pe, blocks, [&blocks](const fragment &frag) {
+							std::visit([&blocks](auto &&f) {
+								blocks.append(f);
+								}, frag);
+							});
+						blocks.flush();
+					} else {
+						fragment_assembler ass(*edt);
+						_render_fragments(*edt, s, pe, ass, [&ass, &r](const fragment &frag) {
+							std::visit([&ass, &r](auto &&f) {
+								auto &&rendering = ass.append(f);
+								ass.render(r, rendering);
+								}, frag);
+							});
 					}
 					r.pop_matrix();
 					r.end_drawing();
-					pages.insert(std::make_pair(s, std::move(rt)));
+					r.get_render_target_pool().release(std::move(pg->second.surface));
+					pg->second.surface = std::move(rt);
+					pg->second.stale = false;
 				}
+				return true;
 			}
 		};
 
@@ -338,7 +616,7 @@ namespace codepad::editors::code {
 			element::_on_prerender();
 			_pgcache.prepare();
 		}
-		/// Renders all visible pages.
+		/// Renders all visible pages. Pages that have not been rendered yet are displayed as placeholders.
 		void _custom_render() const override {
 			element::_custom_render();
 			if (contents_region *edt = component_helper::get_contents_region(*this)) {
@@ -358,15 +636,28 @@ namespace codepad::editors::code {
 				ui::renderer_base &r = get_manager().get_renderer();
 				r.push_rectangle_clip(rectd::from_corners(vec2d(), get_layout().size()));
 				for (auto i = ibeg; i != iend; ++i) {
-					auto &bmp = *i->second.target_bitmap;
 					vec2d topleft(get_padding().left, std::floor(top + slh * static_cast<double>(i->first)));
-					r.draw_rectangle(
-						rectd::from_corner_and_size(topleft, bmp.get_size()),
-						ui::generic_brush_parameters(
-							ui::brush_parameters::bitmap_pattern(&bmp), matd3x3::translate(topleft)
-						),
-						ui::generic_pen_parameters()
-					);
+					double height = std::ceil(slh * static_cast<double>(_pgcache.get_page_end(i) - i->first)) + 1;
+					if (i->second.surface.target_bitmap) {
+						auto &bmp = *i->second.surface.target_bitmap;
+						// stale pages may be larger than the page now is
+						vec2d size = bmp.get_size();
+						size.y = std::min(size.y, height);
+						r.draw_rectangle(
+							rectd::from_corner_and_size(topleft, size),
+							ui::generic_brush_parameters(
+								ui::brush_parameters::bitmap_pattern(&bmp), matd3x3::translate(topleft)
+							),
+							ui::generic_pen_parameters()
+						);
+					} else { // placeholder
+						// TODO customizable color
+						r.draw_rectangle(
+							rectd::from_corner_and_size(topleft, vec2d(get_client_region().width(), height)),
+							ui::generic_brush_parameters(ui::brush_parameters::solid_color(colord(0.5, 0.5, 0.5, 0.1))),
+							ui::generic_pen_parameters()
+						);
+					}
 				}
 				// render visible region indicator
 				_viewport_visuals.render(_get_clamped_viewport_rect(), r);
@@ -434,6 +725,9 @@ namespace codepad::editors::code {
 			if (!_events_registered) {
 				if (auto &&[box, edt] = component_helper::get_core_components(*this); edt) {
 					_events_registered = true;
+					edt->document_edited += [this]() {
+						_on_document_edited();
+					};
 					edt->editing_visual_changed += [this]() {
 						_on_editor_visual_changed();
 					};
@@ -458,10 +752,30 @@ namespace codepad::editors::code {
 		void _on_viewport_changed() {
 			_pgcache.invalidate();
 		}
-		/// Clears \ref _pgcache.
+		/// Updates the pages of \ref _pgcache that are affected by the edit, and sets \ref _edit_handled so that
+		/// the following call to \ref _on_editor_visual_changed() does not mark all pages as stale.
+		void _on_document_edited() {
+			if (contents_region *edt = component_helper::get_contents_region(*this)) {
+				_pgcache.on_edit(*edt);
+				_edit_handled = true;
+			}
+		}
+		/// Marks all pages of \ref _pgcache as stale unless the change has been handled by
+		/// \ref _on_document_edited(), and invalidates the visual of this element so that they're re-rendered.
 		void _on_editor_visual_changed() {
-			_pgcache.pages.clear();
+			if (_edit_handled) {
+				_edit_handled = false;
+			} else if (contents_region *edt = component_helper::get_contents_region(*this)) {
+				_pgcache.on_visual_changed(*edt);
+			}
 			_pgcache.invalidate();
+			invalidate_visual();
+		}
+		/// Invalidates the visual of this element so that pages that have not been rendered are rendered before
+		/// the next frame.
+		void _on_update() override {
+			element::_on_update();
+			invalidate_visual();
 		}
 
 		/// If the user presses ahd holds the primary mouse button on the viewport, starts dragging it; otherwise,
@@ -548,9 +862,13 @@ namespace codepad::editors::code {
 		double _dragoffset = 0.0;
 		bool
 			_dragging = false, ///< Indicates whether the visible region indicator is being dragged.
+			/// Indicates that \ref _pgcache has been updated for the last edit, and that the visual change caused
+			/// by it should be ignored.
+			_edit_handled = false,
 			_events_registered = false; ///< Indicates whether the event handlers have been registered.
 
 		// TODO convert this into a setting
 		static double _target_height; ///< The desired font height of minimaps.
+		static page_rendering_mode _rendering_mode; ///< Determines how the text in minimaps is rendered.
 	};
 }
@@ -14,39 +14,172 @@ using namespace codepad::os;
 
 namespace codepad::editors::code {
 	/// \todo Also consider folded regions.
-	/// \todo Word wrapping not implemented.
-	vector<size_t> contents_region::_recalculate_wrapping_region(size_t, size_t) const {
-		/*
-		vector<size_t> poss;
-		size_t last = 0;
-
-		fragment_generator<folded_region_skipper> iter(
-			make_tuple(cref(_fmt.get_folding()), beg),
-			make_tuple(cref(*_doc), beg)
-		);
-		text_metrics_accumulator metrics(get_font(), get_line_height(), _fmt.get_tab_width());
-
-		while (iter.get_position() < end) {
-			fragment_generation_result res = iter.generate();
-			metrics.next<>(res.result);
-			if (iter.get_position() > last && metrics.get_character().char_right() > _view_width) { // wrap
-				poss.emplace_back(iter.get_position()); // TODO stalls not taken into account
-				metrics.next_line();
-				metrics.next<>(res.result); // TODO better way to re-measure the fragment
+	size_t contents_region::_recalculate_wrapping_region(
+		size_t beg, size_t end, size_t converge,
+		_wrapping_deadline deadline, vector<size_t> &poss
+	) const {
+		performance_monitor mon(CP_STRLIT("recalculate_wrapping"), wrapping_time_slice);
+
+		// existing soft linebreaks at or after converge, used to check whether the results have converged
+		const soft_linebreak_registry &softbreaks = _fmt.get_linebreaks();
+		soft_linebreak_registry::iterator oldsoft = softbreaks.end();
+		size_t oldsoftpos = numeric_limits<size_t>::max();
+		if (converge < _doc->get_linebreaks().num_chars()) {
+			soft_linebreak_registry::softbreak_info info = softbreaks.get_softbreak_before_or_at_char(
+				converge > 0 ? converge - 1 : 0
+			);
+			oldsoft = info.entry;
+			if (oldsoft != softbreaks.end()) {
+				oldsoftpos = info.prev_chars + oldsoft->length;
+			}
+		}
+		// checks if the calculation should stop at the given visual line boundary
+		auto should_stop = [&](size_t pos, bool soft) {
+			if (pos >= end || performance_monitor::clock_t::now() >= deadline) {
+				return true;
+			}
+			if (pos < converge) {
+				return false;
+			}
+			if (!soft) { // wrapping after a hard linebreak never depends on the contents before it
+				return true;
+			}
+			while (oldsoftpos < pos) {
+				++oldsoft;
+				oldsoftpos = oldsoft == softbreaks.end() ? numeric_limits<size_t>::max() : oldsoftpos + oldsoft->length;
+			}
+			return oldsoftpos == pos && _is_char_wrapped(pos);
+		};
+
+		size_t last = beg; // the beginning of the current visual line
+		size_t numchars = _doc->get_linebreaks().num_chars();
+		fragment_generator<fragment_generator_component_hub<>> iter(*get_document(), get_font_families(), beg);
+		fragment_assembler ass(*this);
+		monospace_metrics *mono = _get_monospace_metrics();
+		bool shaping = false; // whether the rest of the current line contains characters that need to be shaped
+		while (iter.get_position() < numchars) {
+			if (mono && !shaping && iter.get_position() == last) {
+				// measure lines arithmetically, until the first character that needs to be shaped
+				double x = 0.0;
+				size_t pos = last;
+				for (interpretation::character_iterator it = _doc->at_character(pos); pos < numchars; ++pos) {
+					if (it.is_linebreak()) {
+						last = pos + 1;
+						if (should_stop(last, false)) {
+							return last;
+						}
+						x = 0.0;
+					} else if (!it.codepoint().is_codepoint_valid()) {
+						shaping = true;
+						break;
+					} else {
+						codepoint cp = it.codepoint().get_codepoint();
+						auto measure = [&]() {
+							return cp == '\t' ?
+								(floor(x / _tab_width) + 1.0) * _tab_width - x :
+								mono->get_character_width(cp);
+						};
+						double width = measure();
+						if (x + width > _view_width && pos > last) {
+							poss.emplace_back(pos);
+							last = pos;
+							if (should_stop(last, true)) {
+								return last;
+							}
+							x = 0.0;
+							width = measure();
+						}
+						x += width;
+					}
+					it.next();
+				}
+				if (!shaping) {
+					return numchars;
+				}
+				// shape the rest of the line, starting from the beginning of the current visual line
+				iter.reposition(last);
+				ass.set_horizontal_position(0.0);
+				continue;
+			}
+			fragment_generation_result res = iter.generate_and_update();
+			size_t fragbeg = iter.get_position() - res.steps;
+			if (holds_alternative<linebreak_fragment>(res.result)) {
+				ass.append(get<linebreak_fragment>(res.result));
 				last = iter.get_position();
+				shaping = false;
+				if (should_stop(last, false)) {
+					return last;
+				}
+				continue;
+			}
+			if (holds_alternative<text_fragment>(res.result)) {
+				fragment_assembler::text_rendering rendering = ass.append(get<text_fragment>(res.result));
+				double left = rendering.topleft.x, offset = 0.0, width = rendering.text->get_width();
+				while (left + width - offset > _view_width) {
+					// break before the first character that does not fit, but keep at least one character on each
+					// visual line
+					caret_hit_test_result htres = rendering.text->hit_test(offset + _view_width - left);
+					size_t brk = max(fragbeg + htres.character, last + 1);
+					if (brk >= iter.get_position()) {
+						break;
+					}
+					poss.emplace_back(brk);
+					last = brk;
+					if (should_stop(last, true)) {
+						return last;
+					}
+					offset = rendering.text->get_character_placement(brk - fragbeg).xmin;
+					left = 0.0;
+				}
+				ass.set_horizontal_position(left + width - offset);
+				continue;
+			}
+			bool stop = false;
+			visit([&](auto &&frag) {
+				ass.append(frag);
+				if (ass.get_horizontal_position() > _view_width && fragbeg > last) { // move to the next line
+					poss.emplace_back(fragbeg);
+					last = fragbeg;
+					stop = should_stop(last, true);
+					ass.set_horizontal_position(0.0);
+					ass.append(frag);
+				}
+				}, res.result);
+			if (stop) {
+				return last;
 			}
-			iter.update(res.steps);
 		}
-		return poss;
-		*/
-		return {};
+		return numchars;
 	}
 
 	double contents_region::_get_caret_pos_x_at_visual_line(size_t line, size_t position) const {
-		size_t
-			linebeg = _fmt.get_linebreaks().get_beginning_char_of_visual_line(
-				_fmt.get_folding().folded_to_unfolded_line_number(line)
-			).first;
+		visual_line_registry::line_info info = _fmt.get_visual_lines().get_line_info(line);
+		if (double x = 0.0; _get_caret_pos_x_monospace(info, position, x)) {
+			return x;
+		}
+		if (info.entry != _fmt.get_visual_lines().end()) { // use the cached layout if possible
+			const line_layout &layout = _get_line_layout(info.first_char, *info.entry);
+			double x = 0.0;
+			for (const fragment_layout &frag : layout.fragments) {
+				size_t fragbeg = info.first_char + frag.position;
+				if (fragbeg >= position) {
+					return x;
+				}
+				if (fragbeg + frag.steps >= position) {
+					if (holds_alternative<text_fragment>(frag.frag)) {
+						const auto &rendering = get<fragment_assembler::text_rendering>(frag.rend);
+						return rendering.topleft.x + rendering.text->get_character_placement(position - fragbeg).xmin;
+					}
+					return x;
+				}
+				x = frag.horizontal_position_after;
+			}
+			if (!layout.truncated) {
+				return x;
+			}
+		}
+
+		size_t linebeg = info.first_char;
 		fragment_generator<fragment_generator_component_hub<soft_linebreak_inserter, folded_region_skipper>> iter(
 			*get_document(), get_font_families(), linebeg,
 			soft_linebreak_inserter(_fmt.get_linebreaks(), linebeg),
@@ -72,10 +205,37 @@ namespace codepad::editors::code {
 	}
 
 	caret_position contents_region::_hit_test_at_visual_line(std::size_t line, double x) const {
-		std::size_t
-			linebeg = _fmt.get_linebreaks().get_beginning_char_of_visual_line(
-				_fmt.get_folding().folded_to_unfolded_line_number(line)
-			).first;
+		visual_line_registry::line_info info = _fmt.get_visual_lines().get_line_info(line);
+		if (caret_position result; _hit_test_monospace(info, x, result)) {
+			return result;
+		}
+		if (info.entry != _fmt.get_visual_lines().end()) { // use the cached layout if possible
+			const line_layout &layout = _get_line_layout(info.first_char, *info.entry);
+			for (const fragment_layout &frag : layout.fragments) {
+				size_t fragbeg = info.first_char + frag.position;
+				if (holds_alternative<linebreak_fragment>(frag.frag)) { // end of the line
+					return caret_position(fragbeg, false);
+				}
+				if (frag.horizontal_position_after > x) {
+					if (holds_alternative<text_fragment>(frag.frag)) {
+						const auto &rendering = get<fragment_assembler::text_rendering>(frag.rend);
+						caret_hit_test_result htres = rendering.text->hit_test(x - rendering.topleft.x);
+						return caret_position(fragbeg + (htres.rear ? htres.character + 1 : htres.character), true);
+					}
+					double left = visit([](auto &&rendering) {
+						return rendering.topleft.x;
+						}, frag.rend);
+					if (x < 0.5 * (left + frag.horizontal_position_after)) {
+						return caret_position(fragbeg, true);
+					}
+				}
+			}
+			if (!layout.truncated) {
+				return caret_position(_doc->get_linebreaks().num_chars(), true);
+			}
+		}
+
+		std::size_t linebeg = info.first_char;
 		fragment_generator<fragment_generator_component_hub<soft_linebreak_inserter, folded_region_skipper>> iter(
 			*get_document(), get_font_families(), linebeg,
 			soft_linebreak_inserter(_fmt.get_linebreaks(), linebeg),
@@ -116,15 +276,183 @@ namespace codepad::editors::code {
 		return caret_position(_doc->get_linebreaks().num_chars(), true);
 	}
 
+	const line_layout &contents_region::_get_line_layout(
+		size_t beg, const visual_line_registry::node_data &line
+	) const {
+		if (!_layout_cache) {
+			_layout_cache = make_shared<line_layout_cache>();
+		}
+		double width = get_layout().width() - get_padding().left;
+		if (const line_layout *cached = _layout_cache->find(beg, line.length, line.type, width)) {
+			return *cached;
+		}
+
+		line_layout layout;
+		layout.length = line.length;
+		layout.type = line.type;
+		size_t numchars = _doc->get_linebreaks().num_chars();
+		if (line.length == 0 && beg < numchars) {
+			// a soft linebreak at the beginning of a hard line, which the generator won't produce when starting
+			// from this position
+			layout.fragments.emplace_back(
+				linebreak_fragment(line_ending::none), fragment_assembler::basic_rendering(vec2d()), 0, 0, 0.0
+			);
+			return _layout_cache->insert(beg, std::move(layout));
+		}
+		fragment_generator<fragment_generator_component_hub<soft_linebreak_inserter, folded_region_skipper>> gen(
+			*get_document(), get_font_families(), beg,
+			soft_linebreak_inserter(_fmt.get_linebreaks(), beg),
+			folded_region_skipper(_fmt.get_folding(), beg)
+		);
+		fragment_assembler ass(*this);
+		while (gen.get_position() < numchars) {
+			size_t pos = gen.get_position();
+			fragment_generation_result frag = gen.generate_and_update();
+			visit([&](auto &&specfrag) {
+				auto &&rendering = ass.append(specfrag);
+				layout.fragments.emplace_back(
+					specfrag, rendering, pos - beg, frag.steps, ass.get_horizontal_position()
+				);
+				}, frag.result);
+			if (holds_alternative<linebreak_fragment>(frag.result)) {
+				break;
+			}
+			if (ass.get_horizontal_position() > width) { // the rest of the line is not visible
+				layout.truncated = true;
+				break;
+			}
+		}
+		return _layout_cache->insert(beg, std::move(layout));
+	}
+
+	void contents_region::_on_folding_changed(size_t beg, size_t end) {
+		if (_layout_cache) {
+			_layout_cache->invalidate(beg, end);
+		}
+		folding_changed.invoke();
+		_on_editing_visual_changed();
+	}
+
+	void contents_region::_invalidate_layout_cache() {
+		if (_layout_cache) {
+			_layout_cache->clear();
+		}
+		_monospace.reset();
+	}
+
+	monospace_metrics *contents_region::_get_monospace_metrics() const {
+		if (_font_families.empty()) {
+			return nullptr;
+		}
+		if (!_monospace) {
+			_monospace = make_shared<monospace_metrics>(_font_families, _font_size);
+		}
+		return _monospace->is_monospace() ? _monospace.get() : nullptr;
+	}
+
+	/// Folded regions are rendered as gizmos, so lines containing them are not measured this way.
+	bool contents_region::_get_caret_pos_x_monospace(
+		const visual_line_registry::line_info &info, size_t position, double &x
+	) const {
+		monospace_metrics *mono = _get_monospace_metrics();
+		if (mono == nullptr || info.entry == _fmt.get_visual_lines().end()) {
+			return false;
+		}
+		size_t end = min(info.first_char + info.entry->length, _doc->get_linebreaks().num_chars());
+		folding_registry::fold_region_info fold = _fmt.get_folding().find_region_containing_or_first_after_open(
+			info.first_char
+		);
+		if (fold.entry != _fmt.get_folding().end() && fold.prev_chars + fold.entry->gap < end) {
+			return false;
+		}
+
+		double curx = 0.0;
+		size_t pos = info.first_char;
+		for (interpretation::character_iterator it = _doc->at_character(pos); pos < min(position, end); ++pos) {
+			if (it.is_linebreak()) {
+				break;
+			}
+			if (!it.codepoint().is_codepoint_valid()) {
+				return false;
+			}
+			codepoint cp = it.codepoint().get_codepoint();
+			if (cp == '\t') {
+				curx = (floor(curx / _tab_width) + 1.0) * _tab_width;
+			} else {
+				curx += mono->get_character_width(cp);
+			}
+			it.next();
+		}
+		x = curx;
+		return true;
+	}
+
+	/// The results are the same as those of the cached layout, including the handling of tabs and the ends of
+	/// lines.
+	bool contents_region::_hit_test_monospace(
+		const visual_line_registry::line_info &info, double x, caret_position &result
+	) const {
+		monospace_metrics *mono = _get_monospace_metrics();
+		if (mono == nullptr || info.entry == _fmt.get_visual_lines().end()) {
+			return false;
+		}
+		size_t
+			numchars = _doc->get_linebreaks().num_chars(),
+			end = min(info.first_char + info.entry->length, numchars);
+		folding_registry::fold_region_info fold = _fmt.get_folding().find_region_containing_or_first_after_open(
+			info.first_char
+		);
+		if (fold.entry != _fmt.get_folding().end() && fold.prev_chars + fold.entry->gap < end) {
+			return false;
+		}
+
+		double curx = 0.0;
+		size_t pos = info.first_char;
+		for (interpretation::character_iterator it = _doc->at_character(pos); pos < end; ++pos) {
+			if (it.is_linebreak()) {
+				result = caret_position(pos, false);
+				return true;
+			}
+			if (!it.codepoint().is_codepoint_valid()) {
+				return false;
+			}
+			codepoint cp = it.codepoint().get_codepoint();
+			double next = cp == '\t' ?
+				(floor(curx / _tab_width) + 1.0) * _tab_width :
+				curx + mono->get_character_width(cp);
+			if (next > x) {
+				result = caret_position(x - curx > 0.5 * (next - curx) ? pos + 1 : pos, true);
+				return true;
+			}
+			curx = next;
+			it.next();
+		}
+		// either the end of the document or a soft linebreak
+		result = pos < numchars ? caret_position(pos, false) : caret_position(numchars, true);
+		return true;
+	}
+
+	void contents_region::_on_document_visual_changed(interpretation::visual_changed_info &info) {
+		if (_layout_cache) {
+			_layout_cache->invalidate(info.begin, info.end);
+		}
+		_on_content_visual_changed();
+	}
+
 	void contents_region::_on_end_edit(buffer::end_edit_info &info) {
 		// fixup view
 		_fmt.fixup_after_edit(info, *_doc);
-		// TODO improve performance
-		_fmt.set_softbreaks(_recalculate_wrapping_region(0, _doc->get_linebreaks().num_chars()));
+		_fixup_wrapping_after_edit();
+		if (_layout_cache) {
+			for (const interpretation::character_modification &mod : _doc->get_character_modifications()) {
+				_layout_cache->on_modification(mod.position, mod.removed_chars, mod.added_chars);
+			}
+		}
 
 		// fixup carets
 		_adjust_recalculate_caret_char_positions(info);
 
+		document_edited.invoke();
 		_on_content_modified();
 	}
 
@@ -150,79 +478,167 @@ namespace codepad::editors::code {
 			used = &extcarets;
 		}
 
-		{ // render to a pixel-snapped buffer to avoid cleartype issues
-			pixel_snapped_render_target target(
-				renderer, rectd::from_corners(vec2d(), get_layout().size()), get_window()->get_scaling_factor()
-			);
+		// find the part of the text that needs to be rendered. if the view has only been scrolled vertically by
+		// whole pixels, the text rendered in the last frame is shifted and only the exposed strip is rendered
+		vec2d
+			size = get_layout().size(),
+			scaling = get_window()->get_scaling_factor(),
+			snap = pixel_snapped_render_target::get_snapping_offset(renderer, vec2d(), scaling);
+		double origin = get_padding().top - editor::get_encapsulating(*this)->get_vertical_position();
+		rectd dirty = rectd::from_corners(vec2d(), size);
+		bool reuse =
+			_text_surface.valid && _text_surface.surface.target_bitmap &&
+			_text_surface.size.x == size.x && _text_surface.size.y == size.y &&
+			_text_surface.scaling.x == scaling.x && _text_surface.scaling.y == scaling.y &&
+			_text_surface.snap_offset.x == snap.x && _text_surface.snap_offset.y == snap.y &&
+			_text_surface.left_padding == get_padding().left;
+		double shift = origin - _text_surface.origin;
+		if (reuse) {
+			double pixels = shift * scaling.y;
+			if (std::abs(pixels - std::round(pixels)) > 1e-3 || std::abs(shift) >= size.y) {
+				reuse = false;
+			} else if (shift > 0.0) {
+				dirty = rectd(0.0, size.x, 0.0, shift);
+			} else {
+				dirty = rectd(0.0, size.x, size.y + shift, size.y);
+			}
+		}
+		bool redraw = dirty.height() > 0.0;
 
-			renderer.push_matrix_mult(matd3x3::translate(vec2d(
-				get_padding().left,
-				get_padding().top - editor::get_encapsulating(*this)->get_vertical_position() +
-				static_cast<double>(be.first) * lh
+		ui::render_target_data target;
+		if (redraw) { // render to a pixel-snapped buffer to avoid cleartype issues
+			target = renderer.get_render_target_pool().acquire(size, scaling);
+			renderer.begin_drawing(*target.target);
+			if (reuse) { // shift the old contents
+				renderer.push_matrix(matd3x3::translate(vec2d(0.0, shift)));
+				renderer.draw_rectangle(
+					rectd::from_corners(vec2d(), _text_surface.surface.target_bitmap->get_size()),
+					ui::generic_brush_parameters(
+						ui::brush_parameters::bitmap_pattern(_text_surface.surface.target_bitmap.get())
+					),
+					ui::generic_pen_parameters()
+				);
+				renderer.pop_matrix();
+			}
+			renderer.push_rectangle_clip(dirty);
+			renderer.push_matrix(matd3x3::translate(vec2d(
+				get_padding().left - snap.x, origin + static_cast<double>(be.first) * lh - snap.y
 			)));
+		}
 
-			// parameters
-			auto flineinfo = _fmt.get_linebreaks().get_beginning_char_of_visual_line(
-				_fmt.get_folding().folded_to_unfolded_line_number(be.first)
-			);
-			std::size_t
-				firstchar = flineinfo.first,
-				plastchar = _fmt.get_linebreaks().get_beginning_char_of_visual_line(
-					_fmt.get_folding().folded_to_unfolded_line_number(be.second)
-				).first,
-				curvisline = be.first;
+		// parameters
+		const visual_line_registry &vislines = _fmt.get_visual_lines();
+		visual_line_registry::line_info lineinfo = vislines.get_line_info(be.first);
+		std::size_t
+			firstchar = lineinfo.first_char,
+			plastchar = vislines.get_beginning_char_of_visual_line(be.second).first,
+			linebeg = firstchar,
+			pos = firstchar;
 
-			// rendering facilities
-			fragment_generator<fragment_generator_component_hub<soft_linebreak_inserter, folded_region_skipper>> gen(
-				*get_document(), get_font_families(), firstchar,
-				soft_linebreak_inserter(_fmt.get_linebreaks(), firstchar),
-				folded_region_skipper(_fmt.get_folding(), firstchar)
-			);
-			fragment_assembler ass(*this);
-			caret_gatherer caretrend(used->carets, firstchar, ass, flineinfo.second == linebreak_type::soft);
-
-			// render text & gather information for carets
-			while (gen.get_position() < plastchar) {
-				fragment_generation_result frag = gen.generate_and_update();
-				// render the fragment
-				std::visit([this, &frag, &gen, &ass, &caretrend](auto &&specfrag) {
-					auto &&rendering = ass.append(specfrag);
-					ass.render(get_manager().get_renderer(), rendering);
-					caretrend.handle_fragment(specfrag, rendering, frag.steps, gen.get_position());
-					}, frag.result);
-				if (std::holds_alternative<linebreak_fragment>(frag.result)) {
-					++curvisline;
-				} else if (ass.get_horizontal_position() + get_padding().left > get_layout().width()) {
-					// skip to the next line
-					++curvisline;
-					auto pos = _fmt.get_linebreaks().get_beginning_char_of_visual_line(
-						_fmt.get_folding().folded_to_unfolded_line_number(curvisline)
-					);
-					// update caret renderer
-					caretrend.skip_line(pos.second == linebreak_type::soft, pos.first);
-					gen.reposition(pos.first); // reposition fragment generator
-					// update fragment assenbler
-					ass.set_horizontal_position(0.0);
-					ass.advance_vertical_position(1);
-				}
-			}
+		// rendering facilities
+		fragment_assembler ass(*this);
+		caret_gatherer caretrend(
+			used->carets, firstchar, ass,
+			lineinfo.entry != vislines.end() && lineinfo.entry->type == linebreak_type::soft
+		);
 
-			caretrend.finish(gen.get_position());
-			// render carets
-			// TODO customizable brush & renderer
-			rounded_selection_renderer rcrend;
-			for (const auto &selrgn : caretrend.get_selection_rects()) {
-				rcrend.render(
-					renderer, selrgn,
-					ui::generic_brush_parameters(ui::brush_parameters::solid_color(colord(0.2, 0.2, 1.0, 0.3))),
-					ui::generic_pen_parameters(ui::generic_brush_parameters(ui::brush_parameters::solid_color(colord(0.0, 0.0, 0.0, 1.0))))
-				);
+		// render text & gather information for carets, using cached layouts of lines when possible
+		for (
+			auto it = lineinfo.entry;
+			it != vislines.end() && linebeg < plastchar;
+			linebeg += it->length, ++it
+			) {
+			const line_layout &layout = _get_line_layout(linebeg, *it);
+			double top = ass.get_vertical_position();
+			// also render adjacent lines, in case that characters extend out of their lines
+			double linetop = origin + static_cast<double>(be.first) * lh + top;
+			bool drawline = redraw && linetop < dirty.ymax + lh && linetop + 2.0 * lh > dirty.ymin;
+			for (const fragment_layout &frag : layout.fragments) {
+				std::size_t fragbeg = linebeg + frag.position;
+				if (fragbeg >= plastchar) {
+					break;
+				}
+				std::visit([&](auto &&specfrag) {
+					using rendering_type = std::decay_t<decltype(ass.append(specfrag))>;
+					rendering_type rendering = std::get<rendering_type>(frag.rend);
+					rendering.topleft.y += top;
+					if (drawline) {
+						ass.render(renderer, rendering);
+					}
+					if constexpr (std::is_same_v<std::decay_t<decltype(specfrag)>, linebreak_fragment>) {
+						ass.append(specfrag);
+					} else {
+						ass.set_horizontal_position(frag.horizontal_position_after);
+					}
+					caretrend.handle_fragment(specfrag, rendering, frag.steps, fragbeg + frag.steps);
+					}, frag.frag);
+				pos = fragbeg + frag.steps;
 			}
-			for (const rectd &rgn : caretrend.get_caret_rects()) {
-				_caret_visuals.render(rgn, renderer);
+			if (layout.truncated) { // skip to the next line
+				auto next = it;
+				++next;
+				pos = linebeg + it->length;
+				// update caret renderer
+				caretrend.skip_line(next != vislines.end() && next->type == linebreak_type::soft, pos);
+				// update fragment assenbler
+				ass.set_horizontal_position(0.0);
+				ass.advance_vertical_position(1);
 			}
+		}
 
+		caretrend.finish(pos);
+		// only keep the layout of lines near the viewport
+		if (_layout_cache) {
+			_layout_cache->prune(
+				vislines.get_beginning_char_of_visual_line(
+					be.first > layout_cache_viewport_margin ? be.first - layout_cache_viewport_margin : 0
+				).first,
+				vislines.get_beginning_char_of_visual_line(be.second + layout_cache_viewport_margin).first + 1
+			);
+		}
+		if (redraw) {
 			renderer.pop_matrix();
+			renderer.pop_clip();
+			renderer.end_drawing();
+			// the old surface is recycled for the next frame
+			renderer.get_render_target_pool().release(std::move(_text_surface.surface));
+			_text_surface.surface = std::move(target);
+			_text_surface.size = size;
+			_text_surface.scaling = scaling;
+			_text_surface.snap_offset = snap;
+			_text_surface.left_padding = get_padding().left;
+			_text_surface.valid = true;
 		}
+		_text_surface.origin = origin;
+		if (_text_surface.surface.target_bitmap) {
+			renderer.push_matrix_mult(matd3x3::translate(snap));
+			renderer.draw_rectangle(
+				rectd::from_corners(vec2d(), _text_surface.surface.target_bitmap->get_size()),
+				ui::generic_brush_parameters(
+					ui::brush_parameters::bitmap_pattern(_text_surface.surface.target_bitmap.get())
+				),
+				ui::generic_pen_parameters()
+			);
+			renderer.pop_matrix();
+		}
+
+		// render carets
+		renderer.push_matrix_mult(matd3x3::translate(vec2d(
+			get_padding().left, origin + static_cast<double>(be.first) * lh
+		)));
+		// TODO customizable brush & renderer
+		rounded_selection_renderer rcrend;
+		for (const auto &selrgn : caretrend.get_selection_rects()) {
+			rcrend.render(
+				renderer, selrgn,
+				ui::generic_brush_parameters(ui::brush_parameters::solid_color(colord(0.2, 0.2, 1.0, 0.3))),
+				ui::generic_pen_parameters(ui::generic_brush_parameters(ui::brush_parameters::solid_color(colord(0.0, 0.0, 0.0, 1.0))))
+			);
+		}
+		for (const rectd &rgn : caretrend.get_caret_rects()) {
+			_caret_visuals.render(rgn, renderer);
+		}
+
+		renderer.pop_matrix();
 	}
 }
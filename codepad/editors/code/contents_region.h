@@ -7,15 +7,22 @@
 /// The code editing component of a \ref codepad::editors::editor.
 
 #include <memory>
+#include <map>
 
 #include "../../core/bst.h"
 #include "../../core/settings.h"
 #include "../editor.h"
 #include "../interaction_modes.h"
 #include "caret_set.h"
+#include "highlighting.h"
+#include "bracket_registry.h"
 #include "view.h"
 
 namespace codepad::editors::code {
+	struct line_layout;
+	class line_layout_cache;
+	class monospace_metrics;
+
 	/// Used to format a \ref codepoint for display.
 	using invalid_codepoint_formatter = std::function<str_t(codepoint)>;
 
@@ -26,35 +33,81 @@ namespace codepad::editors::code {
 	/// \todo Extract caret movement code to somewhere else.
 	class contents_region : public interactive_contents_region_base<caret_set> {
 	public:
+		/// The maximum amount of time that the \ref syntax_highlighter is allowed to run during a single update.
+		constexpr static std::chrono::duration<double> highlighting_time_slice{ 0.005 };
+		/// The maximum amount of time that word wrapping of lines outside of the viewport is allowed to run during
+		/// a single update.
+		constexpr static std::chrono::duration<double> wrapping_time_slice{ 0.005 };
+		/// The maximum amount of time that word wrapping is allowed to run before rendering, or after an edit.
+		/// Lines that have not been wrapped in time are wrapped later in time slices.
+		constexpr static std::chrono::duration<double> wrapping_foreground_time_slice{ 0.02 };
+		/// The number of visual lines above and below the viewport that are wrapped before rendering.
+		constexpr static std::size_t wrapping_viewport_margin = 50;
+		/// The number of visual lines above and below the viewport whose layout is kept in the cache.
+		constexpr static std::size_t layout_cache_viewport_margin = 50;
+
 		/// Sets the \ref interpretation displayed by the contents_region.
 		void set_document(std::shared_ptr<interpretation> newdoc) {
 			_unbind_document_events();
 			_doc = std::move(newdoc);
 			_cset.reset();
+			if (_highlighter && _highlighter->get_interpretation() != _doc) {
+				_highlighter.reset();
+			}
+			if (_brackets && _brackets->get_interpretation() != _doc) {
+				_brackets.reset();
+			}
 			if (_doc) {
+				if (!_brackets) {
+					_brackets = std::make_shared<bracket_registry>(_doc);
+				}
 				_begin_edit_tok = (_doc->get_buffer()->begin_edit += [this](buffer::begin_edit_info &info) {
 					_on_begin_edit(info);
 					});
 				_end_edit_tok = (_doc->end_edit_interpret += [this](buffer::end_edit_info &info) {
 					_on_end_edit(info);
 					});
-				/*_ctx_vis_change_tok = (_doc->visual_changed += [this]() {
-					_on_content_visual_changed();
-					});*/
+				_ctx_vis_change_tok = (_doc->visual_changed += [this](interpretation::visual_changed_info &info) {
+					_on_document_visual_changed(info);
+					});
 				_fmt = view_formatting(*_doc);
 			} else { // empty document, only used when the contents_region's being disposed
 				_fmt = view_formatting();
 			}
+			_invalidate_wrapping();
+			_invalidate_layout_cache();
 			_on_content_modified();
 		}
 		/// Returns the \ref interpretation currently bound to this contents_region.
 		const std::shared_ptr<interpretation> &get_document() const {
 			return _doc;
 		}
+		/// Sets the \ref syntax_highlighter used to highlight the document. The highlighter must be associated with
+		/// the \ref interpretation of this contents_region, and may be shared between multiple views.
+		void set_highlighter(std::shared_ptr<syntax_highlighter> hl) {
+			assert_true_usage(!hl || hl->get_interpretation() == _doc, "highlighter of another document");
+			_highlighter = std::move(hl);
+			invalidate_visual();
+		}
+		/// Returns the \ref syntax_highlighter used to highlight the document.
+		const std::shared_ptr<syntax_highlighter> &get_highlighter() const {
+			return _highlighter;
+		}
+		/// Sets the \ref bracket_registry used to find matching brackets and blocks. The registry must be
+		/// associated with the \ref interpretation of this contents_region, and may be shared between multiple
+		/// views.
+		void set_bracket_registry(std::shared_ptr<bracket_registry> reg) {
+			assert_true_usage(!reg || reg->get_interpretation() == _doc, "bracket registry of another document");
+			_brackets = std::move(reg);
+		}
+		/// Returns the \ref bracket_registry used to find matching brackets and blocks.
+		const std::shared_ptr<bracket_registry> &get_bracket_registry() const {
+			return _brackets;
+		}
 
 		/// Returns the total number of visual lines.
 		std::size_t get_num_visual_lines() const {
-			return _fmt.get_linebreaks().num_visual_lines() - _fmt.get_folding().folded_linebreaks();
+			return _fmt.get_visual_lines().num_visual_lines();
 		}
 
 		/// Sets the font family given its name.
@@ -68,6 +121,8 @@ namespace codepad::editors::code {
 		/// Sets the set of font families.
 		void set_font_families(std::vector<std::unique_ptr<ui::font_family>> fs) {
 			_font_families = std::move(fs);
+			_invalidate_wrapping();
+			_invalidate_layout_cache();
 			_on_editing_visual_changed();
 		}
 		/// Returns the set of font families.
@@ -78,6 +133,8 @@ namespace codepad::editors::code {
 		/// Sets the font size.
 		void set_font_size(double size) {
 			_font_size = size;
+			_invalidate_wrapping();
+			_invalidate_layout_cache();
 			_on_editing_visual_changed();
 		}
 		/// Returns the font size.
@@ -88,6 +145,7 @@ namespace codepad::editors::code {
 		/// Sets the height of a line.
 		void set_line_height(double val) {
 			_line_height = val;
+			_invalidate_layout_cache();
 			_on_editing_visual_changed();
 		}
 		/// Returns the height of a line.
@@ -103,6 +161,8 @@ namespace codepad::editors::code {
 		/// Sets the maximum width of a tab character.
 		void set_tab_width(double w) {
 			_tab_width = w;
+			_invalidate_wrapping();
+			_invalidate_layout_cache();
 			_on_editing_visual_changed();
 		}
 		/// Returns the maximum width of a tab character.
@@ -113,6 +173,8 @@ namespace codepad::editors::code {
 		/// Sets the formatter used to format invalid codepoints.
 		void set_invalid_codepoint_formatter(invalid_codepoint_formatter fmt) {
 			_invalid_cp_fmt = std::move(fmt);
+			_invalidate_wrapping();
+			_invalidate_layout_cache();
 			_on_editing_visual_changed();
 		}
 		/// Returns the formatter used to format invalid codepoints.
@@ -124,6 +186,8 @@ namespace codepad::editors::code {
 		void set_font_size_and_line_height(double fontsize) {
 			_font_size = fontsize;
 			_line_height = _font_size * 1.5; // TODO magic number
+			_invalidate_wrapping();
+			_invalidate_layout_cache();
 			_on_editing_visual_changed();
 		}
 
@@ -169,14 +233,15 @@ namespace codepad::editors::code {
 		const caret_set &get_carets() const override {
 			return _cset;
 		}
-		/// Sets the current carets. The provided set of carets must not be empty. This function calculates the
-		/// horizontal positions of all carets, and scrolls the viewport when necessary.
+		/// Sets the current carets. The provided set of carets must not be empty. This function marks the horizontal
+		/// positions of all carets as invalid so that they're calculated lazily, and scrolls the viewport when
+		/// necessary.
 		void set_carets(const std::vector<caret_selection> &cs) {
 			assert_true_usage(!cs.empty(), "must have at least one caret");
 			caret_set set;
 			for (const caret_selection &sel : cs) {
 				caret_set::entry et(sel, caret_data());
-				et.second.alignment = get_horizontal_caret_position(_extract_position(et));
+				et.second.alignment_valid = false;
 				set.add(et);
 			}
 			set_carets_keepdata(std::move(set));
@@ -187,7 +252,7 @@ namespace codepad::editors::code {
 		void set_carets(caret_set cs) {
 			assert_true_usage(!cs.carets.empty(), "must have at least one caret");
 			for (auto &sel : cs.carets) {
-				sel.second.alignment = get_horizontal_caret_position(_extract_position(sel));
+				sel.second.alignment_valid = false;
 			}
 			set_carets_keepdata(std::move(cs));
 		}
@@ -208,7 +273,7 @@ namespace codepad::editors::code {
 				caret_selection(c.caret, c.selection), caret_data(0.0, c.caret_at_back)
 			));
 			// the added caret may be merged, so alignment is calculated later
-			it->second.alignment = get_horizontal_caret_position(_extract_position(*it));
+			it->second.alignment_valid = false;
 			_on_carets_changed();
 		}
 		/// Removes the given caret.
@@ -241,8 +306,8 @@ namespace codepad::editors::code {
 		}
 	protected:
 		/// Used by \ref move_carets to interpret and organize the return values of the function-like objects.
-		/// This version takes a \ref caret_position -like \p std::pair, calculates the horizontal position of
-		/// the caret, and returns the result. \ref caret_position itself is not used because it would be hard
+		/// This version takes a \ref caret_position -like \p std::pair, marks the horizontal position of the caret
+		/// as invalid, and returns the result. \ref caret_position itself is not used because it would be hard
 		/// for \ref move_carets to determine the new position.
 		caret_set::entry _complete_caret_entry(std::pair<std::size_t, bool> fst, std::size_t scnd) {
 			return caret_set::entry(
@@ -386,17 +451,32 @@ namespace codepad::editors::code {
 		/// \todo Render carets even if they're in a folded region.
 		void add_folded_region(const view_formatting::fold_region &fr) {
 			_fmt.add_folded_region(fr);
-			_on_folding_changed();
+			_on_folding_changed(fr.first, fr.second);
+		}
+		/// Folds all given regions at once.
+		///
+		/// \sa view_formatting::add_folded_regions()
+		void add_folded_regions(const std::vector<view_formatting::fold_region> &frs) {
+			if (frs.empty()) {
+				return;
+			}
+			_fmt.add_folded_regions(frs);
+			std::size_t beg = frs.front().first, end = frs.front().second;
+			for (const view_formatting::fold_region &fr : frs) {
+				beg = std::min(beg, fr.first);
+				end = std::max(end, fr.second);
+			}
+			_on_folding_changed(beg, end);
 		}
 		/// Unfolds the given region.
 		void remove_folded_region(folding_registry::iterator f) {
-			_fmt.remove_folded_region(f);
-			_on_folding_changed();
+			view_formatting::fold_region fr = _fmt.remove_folded_region(f);
+			_on_folding_changed(fr.first, fr.second);
 		}
 		/// Unfolds all currently folded regions.
 		void clear_folded_regions() {
 			_fmt.clear_folded_regions();
-			_on_folding_changed();
+			_on_folding_changed(0, _doc->get_linebreaks().num_chars());
 		}
 
 		/// Returns the range of visual line indices that are visible for the given viewport. Note that the second
@@ -455,6 +535,31 @@ namespace codepad::editors::code {
 					continueselection
 					);
 		}
+		/// Moves all carets to the brackets that match the brackets after them, or the brackets before them if
+		/// there are no brackets after them. Carets that are not next to matched brackets are not moved. Does
+		/// nothing if there's no \ref bracket_registry.
+		///
+		/// \param continueselection Indicates whether selected regions should be kept.
+		void move_all_carets_to_matching_brackets(bool continueselection) {
+			if (!_brackets) {
+				return;
+			}
+			move_carets(
+				[this](const caret_set::entry &et) {
+					std::size_t pos = et.first.first;
+					if (auto res = _brackets->find_matching_bracket(pos)) {
+						return std::make_pair(res.value(), true);
+					}
+					if (pos > 0) {
+						if (auto res = _brackets->find_matching_bracket(pos - 1)) {
+							return std::make_pair(res.value(), true);
+						}
+					}
+					return std::make_pair(pos, et.second.after_stall);
+				},
+				continueselection
+					);
+		}
 		/// Moves all carets one character to the right. If \p continueselection is \p false, then all carets that have
 		/// selected regions will be placed at the back of the selection.
 		///
@@ -477,17 +582,18 @@ namespace codepad::editors::code {
 		void move_all_carets_vertically(int offset, bool continue_selection) {
 			move_carets(
 				[this, offset](const caret_set::entry &et) {
+					double align = _get_caret_alignment(et);
 					auto res = _move_caret_vertically(
-						_get_visual_line_of_caret(_extract_position(et)), offset, et.second.alignment
+						_get_visual_line_of_caret(_extract_position(et)), offset, align
 					);
-					return std::make_pair(res.position, caret_data(et.second.alignment, res.at_back));
+					return std::make_pair(res.position, caret_data(align, res.at_back));
 				},
 				[this, offset](const caret_set::entry &et) {
 					std::size_t ml;
 					double bl;
 					if ((et.first.first > et.first.second) == (offset > 0)) { // move the caret end of the selection
 						ml = _get_visual_line_of_caret(_extract_position(et));
-						bl = et.second.alignment;
+						bl = _get_caret_alignment(et);
 					} else { // move the non-caret end of the selection
 						ml = _get_visual_line_of_caret(caret_position(et.first.second));
 						bl = get_horizontal_caret_position(caret_position(et.first.second));
@@ -513,10 +619,8 @@ namespace codepad::editors::code {
 			move_carets(
 				[this](const caret_set::entry &et) {
 					return std::make_pair(
-						_fmt.get_linebreaks().get_beginning_char_of_visual_line(
-							_fmt.get_folding().folded_to_unfolded_line_number(
-								_get_visual_line_of_caret(_extract_position(et))
-							)
+						_fmt.get_visual_lines().get_beginning_char_of_visual_line(
+							_get_visual_line_of_caret(_extract_position(et))
 						).first, true
 					);
 				},
@@ -532,7 +636,7 @@ namespace codepad::editors::code {
 				[this](const caret_set::entry &et) {
 					std::size_t
 						visline = _get_visual_line_of_caret(_extract_position(et)),
-						unfolded = _fmt.get_folding().folded_to_unfolded_line_number(visline);
+						unfolded = _fmt.get_visual_lines().folded_to_unfolded_line_number(visline);
 					auto linfo = _fmt.get_linebreaks().get_line_info(unfolded);
 					std::size_t begp = std::max(linfo.first.first_char, linfo.second.prev_chars), exbegp = begp;
 					if (linfo.first.first_char >= linfo.second.prev_chars) {
@@ -569,7 +673,7 @@ namespace codepad::editors::code {
 				[this](caret_set::entry cp) {
 					return std::make_pair(
 						_fmt.get_linebreaks().get_past_ending_char_of_visual_line(
-							_fmt.get_folding().folded_to_unfolded_line_number(
+							_fmt.get_visual_lines().folded_to_unfolded_line_number(
 								_get_visual_line_of_caret(_extract_position(cp)) + 1
 							) - 1
 						).first, caret_data(std::numeric_limits<double>::max(), false)
@@ -595,6 +699,10 @@ namespace codepad::editors::code {
 			/// theme of \ref _doc is changed.
 			content_visual_changed,
 			content_modified, ///< Invoked when the \ref interpretation is modified or changed by \ref set_document.
+			/// Invoked when the \ref interpretation has been edited, after this view has been updated and before
+			/// \ref content_modified is invoked. The modifications can be obtained from
+			/// \ref interpretation::get_character_modifications().
+			document_edited,
 			/// Invoked when the set of carets is changed. Note that this does not necessarily mean that the result
 			/// of \ref get_carets will change.
 			carets_changed,
@@ -662,6 +770,10 @@ namespace codepad::editors::code {
 		std::shared_ptr<interpretation> _doc; ///< The \ref interpretation bound to this contents_region.
 		info_event<buffer::begin_edit_info>::token _begin_edit_tok; ///< Used to listen to \ref buffer::begin_edit.
 		info_event<buffer::end_edit_info>::token _end_edit_tok; ///< Used to listen to \ref buffer::end_edit.
+		/// Used to listen to \ref interpretation::visual_changed.
+		info_event<interpretation::visual_changed_info>::token _ctx_vis_change_tok;
+		std::shared_ptr<syntax_highlighter> _highlighter; ///< Used to highlight \ref _doc.
+		std::shared_ptr<bracket_registry> _brackets; ///< Used to find matching brackets in \ref _doc.
 
 		interaction_manager<caret_set> _interaction_manager; ///< The \ref interaction_manager.
 		caret_set _cset; ///< The set of carets.
@@ -680,21 +792,43 @@ namespace codepad::editors::code {
 			_line_height = 18.0; ///< The height of a line.
 		view_formatting _fmt; ///< The \ref view_formatting associated with this contents_region.
 		double _view_width = 0.0; ///< The width that word wrap is calculated according to.
+		/// Caches the layout of visible lines. This is created when it's first used, and is updated during
+		/// rendering.
+		mutable std::shared_ptr<line_layout_cache> _layout_cache;
+		/// Used to measure lines without shaping them when the font is fixed-pitch. This is created when it's
+		/// first used, and is discarded along with \ref _layout_cache.
+		mutable std::shared_ptr<monospace_metrics> _monospace;
+		/// The text rendered in the last frame, which is reused when the view has only been scrolled.
+		struct _rendered_text {
+			ui::render_target_data surface; ///< The surface that the text has been rendered onto.
+			vec2d
+				size, ///< The size of \ref surface.
+				scaling, ///< The scaling factor of \ref surface.
+				snap_offset; ///< The offset used for pixel snapping.
+			double
+				/// The vertical position of the top of the document relative to the top of this element.
+				origin = 0.0,
+				left_padding = 0.0; ///< The left padding of this element.
+			/// Indicates whether \ref surface is still up-to-date, apart from the vertical position.
+			bool valid = false;
+		};
+		mutable _rendered_text _text_surface; ///< The text rendered in the last frame.
+		/// Disjoint ranges of characters that have been wrapped according to \ref _view_width, stored as pairs of
+		/// the first character and the character past the last character. Each range starts at the beginning of a
+		/// visual line, so that wrapping can be resumed from there; long lines can thus be wrapped piece by piece.
+		std::map<std::size_t, std::size_t> _wrapped_chars;
 
 
 		/// Returns the visual line that the given caret is on.
 		std::size_t _get_visual_line_of_caret(caret_position pos) const {
-			auto
-				res = _fmt.get_linebreaks().get_visual_line_and_column_and_softbreak_before_or_at_char(pos.position);
-			std::size_t unfolded = std::get<0>(res);
+			auto [line, info] = _fmt.get_visual_lines().get_line_info_of_char(pos.position);
 			if (
-				!pos.at_back &&
-				std::get<2>(res).entry != _fmt.get_linebreaks().begin() &&
-				std::get<2>(res).prev_chars == pos.position
+				!pos.at_back && line > 0 &&
+				info.first_char == pos.position && info.entry->type == linebreak_type::soft
 				) {
-				--unfolded;
+				--line;
 			}
-			return _fmt.get_folding().unfolded_to_folded_line_number(unfolded);
+			return line;
 		}
 		/// Given a line index and a horizontal position, returns the closest caret position. Note that the
 		/// horizontal position should not include the left padding.
@@ -709,6 +843,33 @@ namespace codepad::editors::code {
 		/// \param line The visual line that the caret is on.
 		/// \param position The position of the caret in the whole document.
 		double _get_caret_pos_x_at_visual_line(std::size_t line, std::size_t position) const;
+		/// Returns the layout of the given visual line from \ref _layout_cache, generating and caching it if
+		/// necessary.
+		///
+		/// \param beg The first character of the line.
+		/// \param line The entry of the line in the \ref visual_line_registry.
+		const line_layout &_get_line_layout(
+			std::size_t beg, const visual_line_registry::node_data &line
+		) const;
+		/// Discards all cached line layouts and \ref _monospace. This should be called when the settings used to
+		/// format text, such as fonts, have been changed.
+		void _invalidate_layout_cache();
+		/// Returns \ref _monospace, creating it if necessary, or \p nullptr if the font is not fixed-pitch.
+		monospace_metrics *_get_monospace_metrics() const;
+		/// Computes the horizontal position of a caret using \ref _monospace if the line contains only characters
+		/// that can be measured without shaping.
+		///
+		/// \return Whether the line can be measured this way. If not, \p x is left unchanged.
+		bool _get_caret_pos_x_monospace(
+			const visual_line_registry::line_info &info, std::size_t position, double &x
+		) const;
+		/// Hit tests a visual line using \ref _monospace if the line contains only characters that can be
+		/// measured without shaping.
+		///
+		/// \return Whether the line can be measured this way. If not, \p result is left unchanged.
+		bool _hit_test_monospace(
+			const visual_line_registry::line_info &info, double x, caret_position &result
+		) const;
 		// TODO this function should also take into account the inter-character position of the caret
 
 		/// Called when the vertical position of the document is changed or when the carets have been moved,
@@ -748,7 +909,7 @@ namespace codepad::editors::code {
 			if (_doc) {
 				_doc->get_buffer()->begin_edit -= _begin_edit_tok;
 				_doc->end_edit_interpret -= _end_edit_tok;
-				/*_doc->visual_changed -= _ctx_vis_change_tok;*/
+				_doc->visual_changed -= _ctx_vis_change_tok;
 			}
 		}
 
@@ -768,8 +929,11 @@ namespace codepad::editors::code {
 			_fmt.prepare_for_edit(*_doc);
 		}
 		/// Called when \ref buffer::end_edit is triggered. Performs necessary adjustments to the view, invokes
-		/// \ref content_modified, then calls \ref _on_content_visual_changed.
+		/// \ref document_edited and \ref content_modified, then calls \ref _on_content_visual_changed.
 		void _on_end_edit(buffer::end_edit_info&);
+		/// Called when \ref interpretation::visual_changed is invoked. Discards the cached layout of affected lines,
+		/// then calls \ref _on_content_visual_changed().
+		void _on_document_visual_changed(interpretation::visual_changed_info&);
 		/// Called when the associated \ref interpretation has been changed to another or when the contents have been
 		/// modified. Invokes \ref content_modified and calls \ref _on_content_visual_changed().
 		void _on_content_modified() {
@@ -798,20 +962,289 @@ namespace codepad::editors::code {
 		/// Note that this does not include the changing of carets. Invokes \ref editing_visual_changed, and calls
 		/// \ref invalidate_visual.
 		void _on_editing_visual_changed() {
+			_text_surface.valid = false;
 			editing_visual_changed.invoke();
 			invalidate_visual();
 		}
-		/// Called when folded regions are added or removed. Invokes \ref folding_changed and calls
-		/// \ref _on_editing_visual_changed.
-		void _on_folding_changed() {
-			folding_changed.invoke();
-			_on_editing_visual_changed();
-		}
+		/// Called when folded regions in the given range are added or removed. Discards the cached layout of all
+		/// lines in the range, since folding a region inside a visual line doesn't change the line's key in
+		/// \ref _layout_cache, then invokes \ref folding_changed and calls \ref _on_editing_visual_changed.
+		void _on_folding_changed(std::size_t beg, std::size_t end);
 
-		/// Recalculates word wrapping for the given lines.
+		/// The type of the deadline used when wrapping text in time slices.
+		using _wrapping_deadline = std::chrono::time_point<
+			performance_monitor::clock_t, std::chrono::duration<double>
+		>;
+		/// Recalculates word wrapping starting from the given position, which should be at the beginning of a
+		/// visual line. The calculation stops at the first visual line boundary that is at or after \p end, at the
+		/// first boundary after which the results are known to coincide with existing wrapped results if it's at
+		/// or after \p converge, or at the first boundary after \p deadline. Since the calculation always stops at
+		/// the beginning of a visual line, it can be resumed from there.
+		///
+		/// \param poss Receives the positions of all soft linebreaks in the range, including the one at the
+		///             returned position if there is one.
+		/// \return The position where the calculation stopped.
+		std::size_t _recalculate_wrapping_region(
+			std::size_t beg, std::size_t end, std::size_t converge,
+			_wrapping_deadline deadline, std::vector<std::size_t> &poss
+		) const;
+		/// Calls \ref _recalculate_wrapping_region(), patches \ref _fmt with the results, and marks the range as
+		/// wrapped. If the range is above the viewport, the viewport is scrolled so that the visible lines don't
+		/// move.
+		///
+		/// \return The position where wrapping stopped.
+		std::size_t _wrap_region(
+			std::size_t beg, std::size_t end, std::size_t converge,
+			_wrapping_deadline deadline
+		) {
+			std::size_t firstvis = _fmt.get_visual_lines().get_beginning_char_of_visual_line(
+				get_visible_visual_lines().first
+			).first;
+			const linebreak_registry &lines = _doc->get_linebreaks();
+			std::vector<std::size_t> breaks;
+			std::size_t stop = _recalculate_wrapping_region(beg, end, converge, deadline, breaks);
+			if (stop >= converge && stop < end && stop < _doc->get_linebreaks().num_chars()) {
+				// if the calculation stopped because of the deadline before the results converged, the wrapped
+				// characters after it in the same line may need to be rewrapped
+				linebreak_registry::line_column_info info = lines.get_line_and_column_of_char(stop);
+				bool converged =
+					info.position_in_line == 0 || (
+						_fmt.get_linebreaks().get_softbreak_before_or_at_char(stop).prev_chars == stop &&
+						_is_char_wrapped(stop)
+					);
+				if (!converged) {
+					std::size_t lineend = info.line + 1 < _doc->num_lines() ?
+						lines.get_line_info(info.line + 1).first_char : lines.num_chars();
+					_cut_wrapped_chars(stop, lineend, lineend);
+				}
+			}
+			// the soft linebreak at beg is kept, while the one at stop is recalculated
+			std::size_t added = breaks.size(), removed = _fmt.replace_softbreaks(beg + 1, stop + 1, breaks);
+			if (stop < firstvis && added != removed) {
+				editor *edt = editor::get_encapsulating(*this);
+				edt->set_vertical_position(
+					edt->get_vertical_position() +
+					(static_cast<double>(added) - static_cast<double>(removed)) * get_line_height()
+				);
+			}
+			_mark_chars_wrapped(beg, stop);
+			return stop;
+		}
+		/// Wraps characters in the given range that have not been wrapped, until all of them have been wrapped or
+		/// the deadline has passed.
 		///
-		/// \todo Currently not of too much use except for calculating word wrapping for the whole document.
-		std::vector<std::size_t> _recalculate_wrapping_region(std::size_t, std::size_t) const;
+		/// \return Whether any soft linebreak has been recalculated.
+		bool _wrap_unwrapped_chars(
+			std::size_t first, std::size_t pend, _wrapping_deadline deadline
+		) {
+			bool changed = false;
+			for (auto range = _find_unwrapped_chars(first, pend); range.first < range.second; ) {
+				// resume from the end of the previous wrapped range, or start from the beginning of the line
+				std::size_t
+					linebeg = range.first -
+					_doc->get_linebreaks().get_line_and_column_of_char(range.first).position_in_line,
+					beg = std::max(linebeg, _get_wrapped_range_end_before(range.first));
+				// if the range is followed by wrapped characters, continue until the results converge
+				_wrap_region(
+					beg, _is_char_wrapped(range.second) ? std::numeric_limits<std::size_t>::max() : range.second,
+					range.second, deadline
+				);
+				changed = true;
+				if (performance_monitor::clock_t::now() >= deadline) {
+					break;
+				}
+				range = _find_unwrapped_chars(first, pend);
+			}
+			return changed;
+		}
+		/// Returns the end of the last wrapped range that ends at or before the given position, or 0 if there's
+		/// no such range.
+		std::size_t _get_wrapped_range_end_before(std::size_t pos) const {
+			auto it = _wrapped_chars.upper_bound(pos);
+			if (it == _wrapped_chars.begin()) {
+				return 0;
+			}
+			--it;
+			return std::min(it->second, pos);
+		}
+		/// Returns whether the given character has been wrapped.
+		bool _is_char_wrapped(std::size_t pos) const {
+			auto it = _wrapped_chars.upper_bound(pos);
+			if (it == _wrapped_chars.begin()) {
+				return false;
+			}
+			--it;
+			return pos < it->second;
+		}
+		/// Marks the given range of characters as wrapped in \ref _wrapped_chars, merging adjacent ranges.
+		void _mark_chars_wrapped(std::size_t first, std::size_t pend) {
+			if (first >= pend) {
+				return;
+			}
+			auto it = _wrapped_chars.upper_bound(first);
+			if (it != _wrapped_chars.begin()) {
+				auto prev = it;
+				--prev;
+				if (prev->second >= first) {
+					first = prev->first;
+					pend = std::max(pend, prev->second);
+					it = prev;
+				}
+			}
+			while (it != _wrapped_chars.end() && it->first <= pend) {
+				pend = std::max(pend, it->second);
+				it = _wrapped_chars.erase(it);
+			}
+			_wrapped_chars.emplace(first, pend);
+		}
+		/// Returns the first range of characters in the given range that has not been wrapped. If all characters
+		/// have been wrapped, the returned range will be empty.
+		std::pair<std::size_t, std::size_t> _find_unwrapped_chars(std::size_t first, std::size_t pend) const {
+			auto it = _wrapped_chars.upper_bound(first);
+			if (it != _wrapped_chars.begin()) {
+				auto prev = it;
+				--prev;
+				first = std::max(first, prev->second);
+			}
+			if (it != _wrapped_chars.end()) {
+				pend = std::min(pend, it->first);
+			}
+			return { first, std::max(first, pend) };
+		}
+		/// Marks all characters in the range [\p first, \p pend) as not wrapped, and shifts all ranges after it by
+		/// \p newpend - \p pend characters.
+		void _cut_wrapped_chars(std::size_t first, std::size_t pend, std::size_t newpend) {
+			auto it = _wrapped_chars.upper_bound(first);
+			if (it != _wrapped_chars.begin()) {
+				--it;
+			}
+			std::vector<std::pair<std::size_t, std::size_t>> shifted;
+			while (it != _wrapped_chars.end()) {
+				auto [rfirst, rpend] = *it;
+				if (rpend <= first) {
+					++it;
+					continue;
+				}
+				it = _wrapped_chars.erase(it);
+				if (rfirst < first) {
+					shifted.emplace_back(rfirst, first);
+				}
+				if (rpend > pend) {
+					shifted.emplace_back(std::max(rfirst, pend) + newpend - pend, rpend + newpend - pend);
+				}
+			}
+			_wrapped_chars.insert(shifted.begin(), shifted.end());
+		}
+		/// Called after the document has been modified. Shifts \ref _wrapped_chars, and rewraps the text around
+		/// each modification, starting from the beginning of the visual line that contains the character before
+		/// it, and stopping as soon as the new soft linebreaks coincide with the old ones, so that editing a very
+		/// long line only rewraps a small part of it. All soft linebreaks have been shifted by
+		/// \ref view_formatting::fixup_after_edit().
+		void _fixup_wrapping_after_edit() {
+			const std::vector<interpretation::character_modification>
+				&mods = _doc->get_character_modifications();
+			// the position to start rewrapping from for each modification, or std::numeric_limits::max() if the
+			// text around the modification has not been wrapped
+			std::vector<std::size_t> starts;
+			for (const interpretation::character_modification &mod : mods) {
+				std::size_t start = mod.position;
+				bool rewrap = mod.position == 0;
+				if (mod.position > 0 && _is_char_wrapped(mod.position - 1)) {
+					std::size_t
+						prev = mod.position - 1,
+						linebeg = prev - _doc->get_linebreaks().get_line_and_column_of_char(prev).position_in_line,
+						softbeg = _fmt.get_linebreaks().get_softbreak_before_or_at_char(prev).prev_chars;
+					auto range = _wrapped_chars.upper_bound(prev);
+					--range;
+					start = std::max({ linebeg, softbeg, range->first });
+					rewrap = true;
+				}
+				_cut_wrapped_chars(start, mod.position + mod.removed_chars, mod.position + mod.added_chars);
+				starts.emplace_back(rewrap ? start : std::numeric_limits<std::size_t>::max());
+			}
+			if (_can_wrap()) {
+				auto deadline = performance_monitor::clock_t::now() + wrapping_foreground_time_slice;
+				std::size_t wrapped_to = 0;
+				for (std::size_t i = 0; i < mods.size(); ++i) {
+					std::size_t converge = mods[i].position + mods[i].added_chars;
+					if (starts[i] == std::numeric_limits<std::size_t>::max() || wrapped_to >= converge) {
+						continue;
+					}
+					// the previous modification may have been rewrapped past the beginning of this one
+					wrapped_to = _wrap_region(
+						std::max(starts[i], wrapped_to), std::numeric_limits<std::size_t>::max(), converge, deadline
+					);
+				}
+				if (_has_pending_wrapping()) {
+					get_manager().get_scheduler().schedule_element_update(*this);
+				}
+			}
+		}
+		/// Returns whether word wrapping can be calculated.
+		bool _can_wrap() const {
+			return _doc && !_font_families.empty() && _view_width > 0.0;
+		}
+		/// Returns whether word wrapping is enabled and there are characters that need to be wrapped.
+		bool _has_pending_wrapping() const {
+			if (!_can_wrap()) {
+				return false;
+			}
+			auto range = _find_unwrapped_chars(0, _doc->get_linebreaks().num_chars());
+			return range.first < range.second;
+		}
+		/// Marks all characters as not wrapped. The soft linebreaks of \ref _fmt are kept as estimations until
+		/// they're recalculated, which happens before rendering for visible lines, and in \ref _on_update() in time
+		/// slices for all other lines.
+		void _invalidate_wrapping() {
+			_wrapped_chars.clear();
+			if (_has_pending_wrapping()) {
+				get_manager().get_scheduler().schedule_element_update(*this);
+			}
+		}
+		/// Returns the range of characters that are visible, extended by \ref wrapping_viewport_margin visual
+		/// lines in both directions.
+		std::pair<std::size_t, std::size_t> _get_wrapping_priority_chars() const {
+			std::pair<std::size_t, std::size_t> be = get_visible_visual_lines();
+			const visual_line_registry &vislines = _fmt.get_visual_lines();
+			return {
+				vislines.get_beginning_char_of_visual_line(
+					be.first > wrapping_viewport_margin ? be.first - wrapping_viewport_margin : 0
+				).first,
+				vislines.get_beginning_char_of_visual_line(be.second + wrapping_viewport_margin).first
+			};
+		}
+		/// Wraps visible characters, and characters near them, that have not been wrapped. Wrapping a single very
+		/// long line is stopped after \ref wrapping_foreground_time_slice and continued in later updates.
+		void _wrap_visible_lines() {
+			if (!_has_pending_wrapping()) {
+				return;
+			}
+			auto [first, pend] = _get_wrapping_priority_chars();
+			if (_wrap_unwrapped_chars(
+				first, std::max(pend, first + 1),
+				performance_monitor::clock_t::now() + wrapping_foreground_time_slice
+			)) {
+				_on_content_visual_changed();
+			}
+			get_manager().get_scheduler().schedule_element_update(*this); // wrap the rest later
+		}
+		/// Wraps characters that have not been wrapped, starting from those near the viewport and then from the
+		/// first such character, until all characters have been wrapped or the time is up.
+		///
+		/// \return Whether there are still characters that need to be wrapped.
+		bool _wrap_pending_lines() {
+			performance_monitor mon(CP_STRLIT("wrap_pending_lines"), wrapping_time_slice);
+			auto deadline = performance_monitor::clock_t::now() + wrapping_time_slice;
+			auto [first, pend] = _get_wrapping_priority_chars();
+			bool changed = _wrap_unwrapped_chars(first, std::max(pend, first + 1), deadline);
+			if (performance_monitor::clock_t::now() < deadline) {
+				changed = _wrap_unwrapped_chars(0, _doc->get_linebreaks().num_chars(), deadline) || changed;
+			}
+			if (changed) {
+				_on_content_visual_changed();
+			}
+			return _has_pending_wrapping();
+		}
 		/// Adjusts and recalculates caret positions from \ref caret_data::bytepos_first and
 		/// \ref caret_data::bytepos_second, after an edit has been made.
 		///
@@ -864,16 +1297,47 @@ namespace codepad::editors::code {
 			double cw = get_client_region().width();
 			if (std::abs(cw - _view_width) > 0.1) { // TODO magik!
 				_view_width = cw;
-				{
-					performance_monitor mon(CP_STRLIT("recalculate_wrapping"));
-					_fmt.set_softbreaks(_recalculate_wrapping_region(0, _doc->get_linebreaks().num_chars()));
-				}
+				_invalidate_wrapping();
 				_on_editing_visual_changed();
 			}
 		}
-		/// Calculates the horizontal position of a caret, and returns the result as a \ref caret_data.
+		/// Returns a \ref caret_data for the given caret whose \ref caret_data::alignment is marked as invalid. The
+		/// alignment is calculated later by \ref _update_visible_caret_alignments() or
+		/// \ref _get_caret_alignment(), so that edits and caret movements don't need to lay out every line that
+		/// contains a caret.
 		caret_data _get_caret_data(caret_position caret) const {
-			return caret_data(get_horizontal_caret_position(caret), caret.at_back);
+			caret_data res(0.0, caret.at_back);
+			res.alignment_valid = false;
+			return res;
+		}
+		/// Returns the alignment of the given caret, calculating it if it has been invalidated.
+		double _get_caret_alignment(const caret_set::entry &et) const {
+			if (et.second.alignment_valid) {
+				return et.second.alignment;
+			}
+			return get_horizontal_caret_position(_extract_position(et));
+		}
+		/// Calculates the alignment of all visible carets whose alignment has been invalidated. Carets outside of
+		/// the viewport are left untouched, and are handled by \ref _get_caret_alignment() when they're moved
+		/// vertically.
+		void _update_visible_caret_alignments() {
+			if (_cset.carets.empty()) {
+				return;
+			}
+			std::pair<std::size_t, std::size_t> be = get_visible_visual_lines();
+			std::size_t
+				firstchar = _fmt.get_visual_lines().get_beginning_char_of_visual_line(be.first).first,
+				plastchar = _fmt.get_visual_lines().get_beginning_char_of_visual_line(be.second).first;
+			for (
+				auto it = _cset.carets.lower_bound(caret_selection(firstchar, 0));
+				it != _cset.carets.end() && it->first.first <= plastchar;
+				++it
+				) {
+				if (!it->second.alignment_valid) {
+					it->second.alignment = get_horizontal_caret_position(_extract_position(*it));
+					it->second.alignment_valid = true;
+				}
+			}
 		}
 
 		/// Moves the given position one character to the left, skipping any folded regions.
@@ -936,9 +1400,20 @@ namespace codepad::editors::code {
 			_interaction_manager.on_capture_lost();
 			_base::_on_capture_lost();
 		}
-		/// Calls \ref interaction_manager::on_update().
+		/// Calls \ref interaction_manager::on_update(), then runs \ref _highlighter and word wrapping for a time
+		/// slice if necessary.
 		void _on_update() override {
 			_interaction_manager.on_update();
+			if (_highlighter && _highlighter->has_pending_work()) {
+				if (_highlighter->update(highlighting_time_slice)) {
+					get_manager().get_scheduler().schedule_element_update(*this);
+				}
+			}
+			if (_has_pending_wrapping()) {
+				if (_wrap_pending_lines()) {
+					get_manager().get_scheduler().schedule_element_update(*this);
+				}
+			}
 			_base::_on_update();
 		}
 
@@ -948,6 +1423,32 @@ namespace codepad::editors::code {
 			_check_wrapping_width();
 			_base::_on_layout_changed();
 		}
+		/// Wraps visible lines, calls \ref _update_visible_caret_alignments() to calculate the alignment of carets
+		/// that are about to be rendered, and prioritizes highlighting of the visible lines.
+		void _on_prerender() override {
+			_base::_on_prerender();
+			_wrap_visible_lines();
+			_update_visible_caret_alignments();
+			_update_highlighting_priority();
+		}
+		/// Sets the visible lines as the lines that \ref _highlighter should handle first, and schedules an update
+		/// if there are lines to highlight.
+		void _update_highlighting_priority() {
+			if (!_highlighter) {
+				return;
+			}
+			std::pair<std::size_t, std::size_t> be = get_visible_visual_lines();
+			std::size_t
+				firstchar = _fmt.get_visual_lines().get_beginning_char_of_visual_line(be.first).first,
+				plastchar = _fmt.get_visual_lines().get_beginning_char_of_visual_line(be.second).first;
+			_highlighter->set_priority_lines(
+				_doc->get_linebreaks().get_line_and_column_of_char(firstchar).line,
+				_doc->get_linebreaks().get_line_and_column_of_char(plastchar).line + 1
+			);
+			if (_highlighter->has_pending_work()) {
+				get_manager().get_scheduler().schedule_element_update(*this);
+			}
+		}
 		/// Renders all visible text.
 		///
 		/// \todo Cannot deal with very long lines.
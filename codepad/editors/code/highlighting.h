@@ -0,0 +1,359 @@
+// Copyright (c) the Codepad contributors. All rights reserved.
+// Licensed under the Apache License, Version 2.0. See LICENSE.txt in the project root for license information.
+
+#pragma once
+
+/// \file
+/// Classes used to incrementally compute the \ref codepad::editors::code::text_theme_data of an
+/// \ref codepad::editors::code::interpretation.
+
+#include <chrono>
+
+#include "../../core/bst.h"
+#include "../../core/profiling.h"
+#include "interpretation.h"
+
+namespace codepad::editors::code {
+	/// The state of a \ref lexer at the beginning of a line. The interpretation of its contents is up to the lexer;
+	/// a stack of integers is enough to represent nested contexts, e.g., strings in interpolations in strings. Two
+	/// states are compared to determine whether lexing can stop.
+	using lexer_state = std::vector<std::size_t>;
+
+	/// A token produced by a \ref lexer.
+	struct lexer_token {
+		/// Default constructor.
+		lexer_token() = default;
+		/// Initializes all fields of this struct.
+		lexer_token(std::size_t beg, std::size_t len, text_theme_specification th) :
+			begin(beg), length(len), theme(th) {
+		}
+
+		std::size_t
+			begin = 0, ///< The column of the first character of this token.
+			length = 0; ///< The number of characters in this token.
+		text_theme_specification theme; ///< The theme of this token.
+	};
+
+	/// Basic interface of a line-based lexer used for syntax highlighting.
+	class lexer {
+	public:
+		/// Default virtual destructor.
+		virtual ~lexer() = default;
+
+		/// Returns the state at the beginning of the document.
+		[[nodiscard]] virtual lexer_state get_initial_state() const {
+			return lexer_state();
+		}
+		/// Returns the theme of characters that are not covered by any token.
+		[[nodiscard]] virtual text_theme_specification get_default_theme() const {
+			return text_theme_specification();
+		}
+
+		/// Lexes a single line.
+		///
+		/// \param line The contents of the line, without the line ending. Invalid codepoints are replaced by
+		///             \ref encodings::replacement_character.
+		/// \param state The state at the beginning of the line. This should be updated to the state at the
+		///              beginning of the next line.
+		/// \param tokens Tokens in this line should be appended to this list in order, and should not overlap.
+		virtual void lex_line(
+			std::basic_string_view<codepoint> line, lexer_state &state, std::vector<lexer_token> &tokens
+		) const = 0;
+	};
+
+	/// Incrementally highlights an \ref interpretation using a \ref lexer, storing the results in the
+	/// \ref text_theme_data of the \ref interpretation. The states of the lexer are recorded at checkpoints that
+	/// are roughly \ref checkpoint_interval lines apart, and the lines between two checkpoints are lexed as a whole.
+	/// After an edit, only segments starting from the checkpoint before the edit are marked as dirty; lexing a dirty
+	/// segment stops at the next checkpoint, and only continues past it if the state there has changed. Dirty
+	/// segments overlapping the lines set by \ref set_priority_lines() are processed first.
+	class syntax_highlighter {
+	public:
+		/// The preferred number of lines between two checkpoints.
+		constexpr static std::size_t checkpoint_interval = 64;
+
+		/// Initializes the highlighter, creates checkpoints for the whole document, and marks all of them as dirty.
+		syntax_highlighter(std::shared_ptr<interpretation> interp, std::unique_ptr<lexer> lex) :
+			_interp(std::move(interp)), _lexer(std::move(lex)) {
+
+			_mod_tok = (_interp->end_edit_interpret += [this](buffer::end_edit_info&) {
+				_on_end_edit();
+			});
+
+			std::vector<checkpoint_data> cps;
+			lexer_state initial = _lexer->get_initial_state();
+			cps.emplace_back(0, initial);
+			for (std::size_t i = checkpoint_interval; i < _interp->num_lines(); i += checkpoint_interval) {
+				cps.emplace_back(checkpoint_interval, initial);
+			}
+			_cps.insert_range_before_move(_cps.end(), cps.begin(), cps.end());
+		}
+		/// No copy construction.
+		syntax_highlighter(const syntax_highlighter&) = delete;
+		/// No copy assignment.
+		syntax_highlighter &operator=(const syntax_highlighter&) = delete;
+		/// Unregisters from \ref interpretation::end_edit_interpret.
+		~syntax_highlighter() {
+			_interp->end_edit_interpret -= _mod_tok;
+		}
+
+		/// Sets the range of lines that should be highlighted before all others, usually the lines that are
+		/// visible in a view.
+		void set_priority_lines(std::size_t beg, std::size_t pend) {
+			_prio_beg = beg;
+			_prio_end = pend;
+		}
+		/// Returns whether there are segments that need to be lexed.
+		bool has_pending_work() const {
+			return _cps.root() != nullptr && _cps.root()->synth_data.total_dirty > 0;
+		}
+		/// Lexes dirty segments until there are none or until the given amount of time has passed. If the theme
+		/// has been changed, invokes \ref interpretation::visual_changed with the range of characters that have
+		/// been lexed.
+		///
+		/// \return Whether there are still segments that need to be lexed.
+		template <typename Dur> bool update(Dur budget) {
+			performance_monitor mon(CP_STRLIT("syntax_highlighting"), budget);
+			auto deadline = performance_monitor::clock_t::now() + budget;
+			std::size_t
+				changedbeg = std::numeric_limits<std::size_t>::max(),
+				changedend = 0;
+			while (has_pending_work()) {
+				auto [it, line] = _find_next_dirty_segment();
+				auto [beg, end] = _lex_segment(it, line);
+				changedbeg = std::min(changedbeg, beg);
+				changedend = std::max(changedend, end);
+				if (performance_monitor::clock_t::now() >= deadline) {
+					break;
+				}
+			}
+			if (changedbeg < changedend) {
+				_interp->visual_changed.invoke_noret(changedbeg, changedend);
+			}
+			return has_pending_work();
+		}
+
+		/// Returns the associated \ref interpretation.
+		const std::shared_ptr<interpretation> &get_interpretation() const {
+			return _interp;
+		}
+	protected:
+		/// A checkpoint that stores the state of the lexer at the beginning of a line.
+		struct checkpoint_data {
+			/// Default constructor.
+			checkpoint_data() = default;
+			/// Initializes all fields of this struct.
+			checkpoint_data(std::size_t gap, lexer_state st, bool d = true) :
+				gap_lines(gap), state(std::move(st)), dirty(d) {
+			}
+
+			/// The number of lines between the previous checkpoint (or the beginning of the document if this is the
+			/// first checkpoint) and this one.
+			std::size_t gap_lines = 0;
+			lexer_state state; ///< The state of the lexer at the beginning of the line.
+			/// Indicates whether the lines between this checkpoint and the next one need to be lexed again.
+			bool dirty = true;
+		};
+		/// Contains additional synthesized data of a subtree.
+		struct checkpoint_synth_data {
+			/// A node in a tree.
+			using node_type = binary_tree_node<checkpoint_data, checkpoint_synth_data>;
+			/// Returns 1 if the checkpoint is dirty, and 0 otherwise.
+			struct get_node_dirty {
+				/// Returns 1 if the checkpoint is dirty, and 0 otherwise.
+				inline static std::size_t get(const node_type &n) {
+					return n.value.dirty ? 1 : 0;
+				}
+			};
+
+			std::size_t
+				total_lines = 0, ///< The total number of lines in this subtree.
+				total_dirty = 0; ///< The total number of dirty checkpoints in this subtree.
+
+			using gap_lines_property = sum_synthesizer::compact_property<
+				synthesization_helper::field_value_property<&checkpoint_data::gap_lines>,
+				&checkpoint_synth_data::total_lines
+			>; ///< Property used to obtain the total number of lines in a subtree.
+			using dirty_property = sum_synthesizer::compact_property<
+				get_node_dirty, &checkpoint_synth_data::total_dirty
+			>; ///< Property used to obtain the total number of dirty checkpoints in a subtree.
+
+			/// Calls \ref sum_synthesizer::synthesize to update the stored values.
+			inline static void synthesize(node_type &n) {
+				sum_synthesizer::synthesize<gap_lines_property, dirty_property>(n);
+			}
+		};
+		/// The type of the tree used to store checkpoints.
+		using tree_type = binary_tree<checkpoint_data, checkpoint_synth_data>;
+		using node_type = tree_type::node; ///< The type of a node in \ref tree_type.
+		using iterator = tree_type::const_iterator; ///< Iterator through the checkpoints.
+
+		/// Used to find the first checkpoint that's after the given line.
+		struct _checkpoint_after_line_finder {
+			/// The underlying \ref sum_synthesizer::index_finder.
+			using finder = sum_synthesizer::index_finder<checkpoint_synth_data::gap_lines_property>;
+			/// Interface for \ref binary_tree::find_custom().
+			int select_find(const node_type &n, std::size_t &l) {
+				return finder::template select_find<>(n, l);
+			}
+		};
+		/// Used to find the first dirty checkpoint, and the line it's at.
+		struct _first_dirty_finder {
+			/// Interface for \ref binary_tree::find_custom().
+			int select_find(const node_type &n, std::size_t&) {
+				if (n.left && n.left->synth_data.total_dirty > 0) {
+					return -1;
+				}
+				if (n.left) {
+					total_lines += n.left->synth_data.total_lines;
+				}
+				total_lines += n.value.gap_lines;
+				if (n.value.dirty) {
+					return 0;
+				}
+				return 1;
+			}
+			std::size_t total_lines = 0; ///< The line that the resulting checkpoint is at.
+		};
+
+		tree_type _cps; ///< Checkpoints.
+		std::vector<lexer_token> _tokens; ///< Buffer used to store the tokens of a single line.
+		std::basic_string<codepoint> _line; ///< Buffer used to store the contents of a single line.
+		/// Buffer used to store the theme runs of a single line.
+		std::vector<std::pair<std::size_t, text_theme_specification>> _runs;
+		std::shared_ptr<interpretation> _interp; ///< The associated \ref interpretation.
+		std::unique_ptr<lexer> _lexer; ///< The lexer.
+		info_event<buffer::end_edit_info>::token _mod_tok; ///< Used to listen to \ref interpretation::end_edit_interpret.
+		std::size_t
+			_prio_beg = 0, ///< The first line that should be highlighted before others.
+			_prio_end = 0; ///< One past the last line that should be highlighted before others.
+
+		/// Returns the checkpoint that starts the segment containing the given line, and the line it's at.
+		std::pair<iterator, std::size_t> _find_segment_of_line(std::size_t line) {
+			std::size_t offset = line;
+			iterator it = _cps.find_custom(_checkpoint_after_line_finder(), offset);
+			--it; // the first checkpoint is always at line 0
+			return { it, line - offset };
+		}
+		/// Returns the dirty checkpoint whose segment should be lexed next, and the line it's at. There must be at
+		/// least one dirty checkpoint.
+		std::pair<iterator, std::size_t> _find_next_dirty_segment() {
+			if (_prio_beg < _prio_end) {
+				auto [it, line] = _find_segment_of_line(_prio_beg);
+				while (it != _cps.end() && line < _prio_end) {
+					if (it->dirty) {
+						return { it, line };
+					}
+					++it;
+					if (it != _cps.end()) {
+						line += it->gap_lines;
+					}
+				}
+			}
+			_first_dirty_finder finder;
+			std::size_t dummy = 0;
+			iterator it = _cps.find_custom(finder, dummy);
+			assert_true_logical(it != _cps.end(), "no dirty checkpoint");
+			return { it, finder.total_lines };
+		}
+
+		/// Lexes the segment starting from the given checkpoint, updates the theme of these lines, and updates the
+		/// state stored at the next checkpoint, marking it as dirty if the state has changed. New checkpoints are
+		/// inserted if the segment is too long.
+		///
+		/// \return The range of characters whose theme has been updated.
+		std::pair<std::size_t, std::size_t> _lex_segment(iterator it, std::size_t line) {
+			lexer_state state = it->state;
+			{
+				auto mod = _cps.get_modifier_for(it.get_node());
+				mod->dirty = false;
+			}
+			iterator next = it;
+			++next;
+			std::size_t
+				numlines = _interp->num_lines(),
+				endline = next == _cps.end() ? numlines : line + next->gap_lines,
+				linechar = _interp->get_linebreaks().get_line_info(line).first_char,
+				begchar = linechar,
+				sincecp = 0;
+			text_theme_data &theme = _interp->get_text_theme();
+			text_theme_specification deftheme = _lexer->get_default_theme();
+			interpretation::character_iterator cit = _interp->at_character(linechar);
+			for (; line < endline; ++line, ++sincecp) {
+				if (sincecp == checkpoint_interval) { // insert a new checkpoint
+					_cps.emplace_before(next, checkpoint_interval, state, false);
+					if (next != _cps.end()) {
+						auto mod = _cps.get_modifier_for(next.get_node());
+						mod->gap_lines -= checkpoint_interval;
+					}
+					sincecp = 0;
+				}
+				// gather the contents of the line
+				_line.clear();
+				for (; !cit.is_linebreak(); cit.next()) {
+					const interpretation::codepoint_iterator &cpit = cit.codepoint();
+					_line.push_back(
+						cpit.is_codepoint_valid() ? cpit.get_codepoint() : encodings::replacement_character
+					);
+				}
+				bool haslinebreak = cit.get_linebreak() != line_ending::none;
+				std::size_t linelen = _line.size() + (haslinebreak ? 1 : 0);
+				// lex & update the theme
+				_tokens.clear();
+				_lexer->lex_line(_line, state, _tokens);
+				_runs.clear();
+				std::size_t col = 0;
+				for (const lexer_token &tok : _tokens) {
+					if (tok.begin > col) {
+						_runs.emplace_back(tok.begin - col, deftheme);
+					}
+					_runs.emplace_back(tok.length, tok.theme);
+					col = tok.begin + tok.length;
+				}
+				if (linelen > col) {
+					_runs.emplace_back(linelen - col, deftheme);
+				}
+				theme.replace_range(linechar, _runs.begin(), _runs.end());
+				linechar += linelen;
+				if (haslinebreak) {
+					cit.next();
+				}
+			}
+			if (next != _cps.end() && next->state != state) {
+				auto mod = _cps.get_modifier_for(next.get_node());
+				mod->state = std::move(state);
+				mod->dirty = true;
+			}
+			return { begchar, linechar };
+		}
+
+		/// Called when \ref interpretation::end_edit_interpret is invoked. Adjusts the positions of checkpoints,
+		/// removes those that are in removed lines, and marks the segments containing modifications as dirty.
+		void _on_end_edit() {
+			for (const interpretation::character_modification &mod : _interp->get_character_modifications()) {
+				auto [it, line] = _find_segment_of_line(mod.line);
+				{
+					auto itmod = _cps.get_modifier_for(it.get_node());
+					itmod->dirty = true;
+				}
+				// remove checkpoints whose lines have been merged into others
+				iterator beg = it, end = it;
+				++beg;
+				++end;
+				std::size_t endline = line;
+				while (end != _cps.end()) {
+					endline += end->gap_lines;
+					if (endline > mod.line + mod.removed_linebreaks) {
+						break;
+					}
+					++end;
+				}
+				_cps.erase(beg, end);
+				if (end != _cps.end()) {
+					auto endmod = _cps.get_modifier_for(end.get_node());
+					endmod->gap_lines = endline + mod.added_linebreaks - mod.removed_linebreaks - line;
+				}
+			}
+		}
+	};
+}
@@ -7,6 +7,7 @@
 /// Implementation of classes used to interpret a \ref codepad::editors::buffer.
 
 #include <map>
+#include <limits>
 
 #include "../../core/encodings.h"
 #include "../buffer.h"
@@ -169,6 +170,43 @@ namespace codepad::editors::code {
 		/// The type of a node in the tree.
 		using node_type = tree_type::node;
 
+		/// Describes a single modification in terms of characters and lines. Similar to
+		/// \ref buffer::modification_position, the position is obtained after all previous modifications have been
+		/// made.
+		struct character_modification {
+			/// Default constructor.
+			character_modification() = default;
+			/// Initializes all fields of this struct.
+			character_modification(
+				std::size_t pos, std::size_t remchars, std::size_t addchars,
+				std::size_t l, std::size_t remlines, std::size_t addlines
+			) : position(pos), removed_chars(remchars), added_chars(addchars),
+				line(l), removed_linebreaks(remlines), added_linebreaks(addlines) {
+			}
+
+			std::size_t
+				position = 0, ///< The position of the first modified character.
+				removed_chars = 0, ///< The number of removed characters.
+				added_chars = 0, ///< The number of inserted characters.
+				line = 0, ///< The line that \ref position is on.
+				removed_linebreaks = 0, ///< The number of removed linebreaks.
+				added_linebreaks = 0; ///< The number of inserted linebreaks.
+		};
+		/// Contains information about a change of the visuals of this interpretation, i.e., the range of characters
+		/// that are affected.
+		struct visual_changed_info {
+			/// Default constructor. The whole document is affected.
+			visual_changed_info() = default;
+			/// Initializes all fields of this struct.
+			visual_changed_info(std::size_t beg, std::size_t pend) : begin(beg), end(pend) {
+			}
+
+			std::size_t
+				begin = 0, ///< The first affected character.
+				/// One past the last affected character.
+				end = std::numeric_limits<std::size_t>::max();
+		};
+
 		/// Used to iterate through codepoints in this interpretation.
 		struct codepoint_iterator {
 			friend interpretation;
@@ -475,6 +513,16 @@ namespace codepad::editors::code {
 		const text_theme_data &get_text_theme() const {
 			return _theme;
 		}
+		/// Returns the \ref text_theme_data associated with this \ref interpretation for modification. The caller
+		/// is responsible of invoking \ref visual_changed afterwards.
+		text_theme_data &get_text_theme() {
+			return _theme;
+		}
+		/// Returns the modifications made by the last edit, in characters and lines. This is only meaningful in
+		/// handlers of \ref end_edit_interpret.
+		const std::vector<character_modification> &get_character_modifications() const {
+			return _char_mods;
+		}
 		/// Returns the default line ending for this \ref interpretation.
 		line_ending get_default_line_ending() const {
 			return _line_ending;
@@ -618,11 +666,15 @@ namespace codepad::editors::code {
 		/// Invoked when an edit has been made to the underlying \ref buffer, after this \ref interpretation has
 		/// finished updating.
 		info_event<buffer::end_edit_info> end_edit_interpret;
-		// TODO visual_changed event
+		/// Invoked when the visual of this \ref interpretation, such as the theme of the text, has changed without
+		/// the text itself being modified.
+		info_event<visual_changed_info> visual_changed;
 	protected:
 		tree_type _chks; ///< Chunks used to speed up navigation.
 		text_theme_data _theme; ///< Theme of the text.
 		linebreak_registry _lbs; ///< Records all linebreaks.
+		/// The modifications of the last edit in characters and lines, computed by \ref _post_edit_fixup().
+		std::vector<character_modification> _char_mods;
 
 		const std::shared_ptr<buffer> _buf; ///< The underlying \ref buffer.
 		info_event<buffer::begin_edit_info>::token _begin_edit_tok; ///< Used to listen to \ref buffer::begin_edit.
@@ -786,6 +838,7 @@ namespace codepad::editors::code {
 		/// Adjusts \ref _chks and \ref _lbs after an edit has been made.
 		void _post_edit_fixup(buffer::end_edit_info &info) {
 			_debug_log_post_edit_fixup("starting post-edit fixup");
+			_char_mods.clear();
 			std::size_t
 				lastbyte = 0, // number of bytes before lastchk
 				lastcp = 0; // number of codepoints before lastchk
@@ -903,8 +956,19 @@ namespace codepad::editors::code {
 				}
 				lastchk = chkit;
 				// lines
+				auto
+					firstpos = _lbs.get_line_and_column_and_char_of_codepoint(firstcp),
+					endpos = _lbs.get_line_and_column_and_char_of_codepoint(endcp);
 				_lbs.erase_codepoints(firstcp, endcp);
 				_lbs.insert_codepoints(firstcp, lines.result());
+				auto newendpos = _lbs.get_line_and_column_and_char_of_codepoint(cppos);
+				character_modification &charmod = _char_mods.emplace_back(
+					firstpos.second, endpos.second - firstpos.second, newendpos.second - firstpos.second,
+					firstpos.first.line,
+					endpos.first.line - firstpos.first.line, newendpos.first.line - firstpos.first.line
+				);
+				// theme
+				_theme.on_modification(charmod.position, charmod.removed_chars, charmod.added_chars);
 
 				modit = nextmodit;
 			}
@@ -913,8 +977,6 @@ namespace codepad::editors::code {
 		}
 
 		/// Called when an edit is about to be made to \ref _buf.
-		///
-		/// \todo Prepare \ref _theme for fixup.
 		void _on_begin_edit(buffer::begin_edit_info&) {
 
 		}
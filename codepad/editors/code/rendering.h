@@ -7,6 +7,8 @@
 /// Structs used to render the contents of a \ref codepad::editors::code::contents_region.
 
 #include <tuple>
+#include <array>
+#include <unordered_map>
 
 #include "../buffer.h"
 #include "interpretation.h"
@@ -148,13 +150,13 @@ namespace codepad::editors::code {
 		}
 		/// Implementation of \ref update().
 		template <std::size_t ...Indices> void _update_impl(
-			std::size_t oldpos, std::size_t steps, std::index_sequence<Indices...>
+			[[maybe_unused]] std::size_t oldpos, [[maybe_unused]] std::size_t steps, std::index_sequence<Indices...>
 		) {
 			(..., std::get<Indices>(_components).update(oldpos, steps));
 		}
 		/// Implementation of \ref reposition().
 		template <std::size_t ...Indices> void _reposition_impl(
-			std::size_t position, std::index_sequence<Indices...>
+			[[maybe_unused]] std::size_t position, std::index_sequence<Indices...>
 		) {
 			(..., std::get<Indices>(_components).reposition(position));
 		}
@@ -266,7 +268,7 @@ namespace codepad::editors::code {
 			for (std::size_t i = 0; i < _font_set.size(); ++i) {
 				if (_cached_fonts.size() <= i) { // the font has not been cached yet
 					// TODO custom font stretch
-					_cached_fonts.emplace_back(_font_set[i]->get_matching_font(
+					_cached_fonts.emplace_back(_font_set[i]->get_matching_font_shared(
 						_theme_it.current_theme.style, _theme_it.current_theme.weight, ui::font_stretch::normal
 					));
 				}
@@ -383,11 +385,12 @@ namespace codepad::editors::code {
 			/// Default constructor.
 			text_rendering() = default;
 			/// Initializes all fields of this struct.
-			text_rendering(std::unique_ptr<ui::plain_text> t, vec2d pos, double basecorr, colord c) :
+			text_rendering(std::shared_ptr<ui::plain_text> t, vec2d pos, double basecorr, colord c) :
 				text(std::move(t)), topleft(pos), baseline_correction(basecorr), color(c) {
 			}
 
-			std::unique_ptr<ui::plain_text> text; ///< The formatted text.
+			/// The formatted text. This is shared so that renderings can be cached by \ref line_layout_cache.
+			std::shared_ptr<ui::plain_text> text;
 			vec2d topleft; ///< The top-left position of this fragment, without \ref baseline_correction.
 			/// The offset to add to the result of \ref get_vertical_position() to align the baseline of all text.
 			double baseline_correction = 0.0;
@@ -472,7 +475,7 @@ namespace codepad::editors::code {
 		text_rendering append(const invalid_codepoint_fragment &frag) {
 			str_t textrepr = _invalid_cp_fmt(frag.value);
 			// TODO custom style
-			auto font = _font_family.get_matching_font(
+			auto font = _font_family.get_matching_font_shared(
 				ui::font_style::italic, ui::font_weight::normal, ui::font_stretch::normal
 			);
 			return _append_text(str_view_t(textrepr), *font, _font_size, _invalid_cp_color);
@@ -491,7 +494,7 @@ namespace codepad::editors::code {
 		}
 		/// Appends a \ref text_gizmo_fragment to the rendered document by calling \ref _append_text().
 		text_rendering append(const text_gizmo_fragment &frag) {
-			auto font = _renderer->find_font_family(frag.font.family)->get_matching_font(
+			auto font = _renderer->find_font_family_shared(frag.font.family)->get_matching_font_shared(
 				frag.font.style, frag.font.weight, frag.font.stretch
 			);
 			return _append_text(str_view_t(frag.contents), *font, frag.font.size, frag.color);
@@ -534,6 +537,310 @@ namespace codepad::editors::code {
 	};
 
 
+	/// Renders fragments as blocks of solid color without shaping or drawing any text. Consecutive characters
+	/// with the same color are merged into a single rectangle, which makes this much cheaper than
+	/// \ref fragment_assembler. This is used for previews in which individual glyphs are not legible anyway, like
+	/// that of the \ref minimap. The interface for positioning is the same as that of \ref fragment_assembler, but
+	/// fragments are rendered immediately when they're appended, and \ref flush() must be called after the last one.
+	class fragment_block_renderer {
+	public:
+		/// The height of blocks relative to the line height, so that consecutive lines can be told apart.
+		constexpr static double block_height_ratio = 0.7;
+
+		/// Initializes the renderer and spacing.
+		fragment_block_renderer(
+			ui::renderer_base &r, double charw, double lh, double tabw,
+			invalid_codepoint_formatter fmt, colord invclr
+		) :
+			_renderer(&r), _invalid_cp_fmt(std::move(fmt)), _invalid_cp_color(invclr),
+			_char_width(charw), _line_height(lh), _tab_width(tabw) {
+		}
+		/// Initializes this struct using the given \ref contents_region. The width of all characters is assumed to
+		/// be that of `x' in the primary font.
+		explicit fragment_block_renderer(const contents_region &rgn) : fragment_block_renderer(
+			rgn.get_manager().get_renderer(),
+			rgn.get_font_size() * rgn.get_font_families()[0]->get_matching_font_shared(
+				ui::font_style::normal, ui::font_weight::normal, ui::font_stretch::normal
+			)->get_character_width_em('x'),
+			rgn.get_line_height(), rgn.get_tab_width(),
+			rgn.get_invalid_codepoint_formatter(), rgn.get_invalid_codepoint_color()
+		) {
+		}
+
+		/// Sets the horizontal position of the next fragment.
+		void set_horizontal_position(double pos) {
+			_xpos = pos;
+		}
+		/// Returns the horizontal position of the next fragment.
+		double get_horizontal_position() const {
+			return _xpos;
+		}
+		/// Renders the pending block, then increases the vertical position by the given number times the line
+		/// height.
+		void advance_vertical_position(std::size_t lines) {
+			flush();
+			_line_top += static_cast<double>(lines) * _line_height;
+		}
+		/// Returns the top position of the current line.
+		double get_vertical_position() const {
+			return _line_top;
+		}
+
+		/// Does nothing.
+		void append(const no_fragment&) {
+		}
+		/// Appends a block for each run of non-whitespace characters in the \ref text_fragment.
+		void append(const text_fragment &frag) {
+			for (codepoint cp : frag.text) {
+				if (cp != ' ' && cp != 0x3000) { // skip spaces and ideographic spaces
+					_append_block(_char_width, frag.color);
+				} else {
+					_xpos += _char_width;
+				}
+			}
+		}
+		/// Moves the current position to the next tab stop.
+		void append(const tab_fragment&) {
+			_xpos = (std::floor(_xpos / _tab_width) + 1.0) * _tab_width;
+		}
+		/// Appends a block with the width of the formatted codepoint.
+		void append(const invalid_codepoint_fragment &frag) {
+			_append_block(
+				static_cast<double>(_invalid_cp_fmt(frag.value).size()) * _char_width, _invalid_cp_color
+			);
+		}
+		/// Moves the current position to the beginning of the next line.
+		void append(const linebreak_fragment&) {
+			advance_vertical_position(1);
+			_xpos = 0.0;
+		}
+		/// Does nothing.
+		void append(const image_gizmo_fragment&) {
+			// TODO
+		}
+		/// Appends a block with the width of the contents of the \ref text_gizmo_fragment.
+		void append(const text_gizmo_fragment &frag) {
+			_append_block(static_cast<double>(frag.contents.size()) * _char_width, frag.color);
+		}
+
+		/// Renders the pending block, if there is one.
+		void flush() {
+			if (_block_end > _block_begin) {
+				double gap = 0.5 * (1.0 - block_height_ratio) * _line_height;
+				_renderer->draw_rectangle(
+					rectd(_block_begin, _block_end, _line_top + gap, _line_top + _line_height - gap),
+					ui::generic_brush_parameters(ui::brush_parameters::solid_color(_block_color)),
+					ui::generic_pen_parameters()
+				);
+			}
+			_block_begin = _block_end = 0.0;
+		}
+	protected:
+		ui::renderer_base *_renderer = nullptr; ///< The renderer.
+		invalid_codepoint_formatter _invalid_cp_fmt; ///< Used to determine the width of invalid codepoints.
+		colord
+			_invalid_cp_color, ///< The color of invalid codepoints.
+			_block_color; ///< The color of the pending block.
+		double
+			_char_width = 0.0, ///< The width of a single character.
+			_line_height = 0.0, ///< The height of a line.
+			_tab_width = 0.0, ///< The maximum width of a tab character.
+			_line_top = 0.0, ///< The top of the current line.
+			_xpos = 0.0, ///< The horizontal position, relative to the left side of the document.
+			_block_begin = 0.0, ///< The left side of the pending block.
+			_block_end = 0.0; ///< The right side of the pending block.
+
+		/// Appends a block of the given width and color at the current position, merging it with the pending
+		/// block if possible.
+		void _append_block(double width, colord color) {
+			if (_block_end != _xpos || _block_color != color) {
+				flush();
+				_block_begin = _xpos;
+				_block_color = color;
+			}
+			_xpos += width;
+			_block_end = _xpos;
+		}
+	};
+
+
+	/// A fragment in a visual line and its rendering.
+	struct fragment_layout {
+		/// The rendering of either kind of fragment.
+		using rendering = std::variant<fragment_assembler::basic_rendering, fragment_assembler::text_rendering>;
+
+		/// Default constructor.
+		fragment_layout() = default;
+		/// Initializes all fields of this struct.
+		template <typename Frag, typename Rendering> fragment_layout(
+			const Frag &f, const Rendering &r, std::size_t pos, std::size_t s, double x
+		) : frag(std::in_place_type<Frag>, f), rend(std::in_place_type<Rendering>, r),
+			position(pos), steps(s), horizontal_position_after(x) {
+		}
+
+		fragment frag; ///< The fragment.
+		rendering rend; ///< The rendering of the fragment, relative to the top of the line.
+		std::size_t
+			position = 0, ///< The position of this fragment relative to the beginning of the line.
+			steps = 0; ///< The number of characters in this fragment.
+		/// The horizontal position of the \ref fragment_assembler after this fragment has been appended.
+		double horizontal_position_after = 0.0;
+	};
+	/// The layout of a single visual line.
+	struct line_layout {
+		std::vector<fragment_layout> fragments; ///< All fragments in this line.
+		std::size_t length = 0; ///< The number of characters in this line.
+		linebreak_type type = linebreak_type::hard; ///< The type of the linebreak before this line.
+		/// Indicates that fragments after the last one are not generated because they're outside of the viewport.
+		bool truncated = false;
+	};
+	/// Caches the layout of visual lines, i.e., the fragments generated for each line and their renderings, so
+	/// that lines that have not changed need not be generated and formatted again when only the carets have
+	/// changed or when the view has been scrolled. Each line is identified by the position of its first character,
+	/// its length, and the type of the linebreak before it, so that changes of soft linebreaks and folded regions
+	/// are detected automatically. Modifications to the document and changes of the theme must be reported
+	/// explicitly, so that only affected lines are discarded.
+	class line_layout_cache {
+	public:
+		/// Returns the layout of the line starting at the given position, or \p nullptr if there's none or if the
+		/// line has changed. \p width is the maximum width that lines are truncated to; all cached lines are
+		/// discarded if it has changed.
+		const line_layout *find(std::size_t beg, std::size_t length, linebreak_type type, double width) {
+			if (width != _width) {
+				clear();
+				_width = width;
+				return nullptr;
+			}
+			auto it = _lines.find(beg);
+			if (it == _lines.end() || it->second.length != length || it->second.type != type) {
+				return nullptr;
+			}
+			return &it->second;
+		}
+		/// Caches the layout of the line starting at the given position, replacing the old entry if there is one.
+		const line_layout &insert(std::size_t beg, line_layout layout) {
+			return _lines.insert_or_assign(beg, std::move(layout)).first->second;
+		}
+
+		/// Discards all lines that contain any character in the given range, or that start or end at either
+		/// end of the range.
+		void invalidate(std::size_t beg, std::size_t end) {
+			auto it = _lines.upper_bound(beg);
+			if (it != _lines.begin()) {
+				auto prev = it;
+				--prev;
+				if (prev->first + prev->second.length >= beg) {
+					it = prev;
+				}
+			}
+			while (it != _lines.end() && it->first <= end) {
+				it = _lines.erase(it);
+			}
+		}
+		/// Discards all lines affected by the given modification, and shifts all lines after it.
+		void on_modification(std::size_t pos, std::size_t removed, std::size_t added) {
+			invalidate(pos, pos + removed);
+			auto it = _lines.upper_bound(pos + removed);
+			if (it == _lines.end() || added == removed) {
+				return;
+			}
+			std::vector<std::pair<std::size_t, line_layout>> shifted;
+			while (it != _lines.end()) {
+				auto node = _lines.extract(it++);
+				shifted.emplace_back(node.key() + added - removed, std::move(node.mapped()));
+			}
+			for (auto &entry : shifted) {
+				_lines.emplace(entry.first, std::move(entry.second));
+			}
+		}
+		/// Discards all lines that start outside of the given range.
+		void prune(std::size_t beg, std::size_t end) {
+			_lines.erase(_lines.begin(), _lines.lower_bound(beg));
+			_lines.erase(_lines.lower_bound(end), _lines.end());
+		}
+		/// Discards all lines.
+		void clear() {
+			_lines.clear();
+		}
+	protected:
+		/// The layout of lines, indexed by the positions of their first characters.
+		std::map<std::size_t, line_layout> _lines;
+		double _width = 0.0; ///< The maximum width that lines are truncated to.
+	};
+
+	/// Measures characters using the regular fonts of a set of font families, so that lines containing only
+	/// ordinary characters can be measured arithmetically without being shaped when the primary font is
+	/// fixed-pitch. The font of each character is selected in the same way as \ref fragment_generator selects
+	/// fonts. Widths of ASCII characters are measured in advance, while widths of all other characters, such as
+	/// double-width CJK characters or characters only covered by backup fonts, are measured when they're first
+	/// used. Text styles are ignored, assuming that all styles of a fixed-pitch font have the same advance.
+	class monospace_metrics {
+	public:
+		/// Creates the fonts, measures ASCII characters, and checks if the primary font is fixed-pitch.
+		monospace_metrics(const std::vector<std::unique_ptr<ui::font_family>> &families, double size) :
+			_font_size(size) {
+			for (const auto &family : families) {
+				_fonts.emplace_back(family->get_matching_font(
+					ui::font_style::normal, ui::font_weight::normal, ui::font_stretch::normal
+				));
+			}
+			if (_fonts.empty()) {
+				return;
+			}
+			for (std::size_t i = 0; i < _ascii_widths.size(); ++i) {
+				_ascii_widths[i] = _measure(static_cast<codepoint>(i));
+			}
+			_advance = _ascii_widths['0'];
+			_monospace = _advance > 0.0;
+			for (char c : std::string_view(" .0MWilm")) {
+				if (std::abs(_ascii_widths[static_cast<std::size_t>(c)] - _advance) > 1e-4 * _font_size) {
+					_monospace = false;
+					break;
+				}
+			}
+		}
+
+		/// Returns whether the primary font is fixed-pitch.
+		bool is_monospace() const {
+			return _monospace;
+		}
+		/// Returns the width of a single-width character.
+		double get_advance() const {
+			return _advance;
+		}
+		/// Returns the width of the given character, measuring it if necessary.
+		double get_character_width(codepoint cp) {
+			if (cp < _ascii_widths.size()) {
+				return _ascii_widths[cp];
+			}
+			auto [it, inserted] = _widths.try_emplace(cp, 0.0);
+			if (inserted) {
+				it->second = _measure(cp);
+			}
+			return it->second;
+		}
+	protected:
+		std::vector<std::unique_ptr<ui::font>> _fonts; ///< The regular font of each font family.
+		std::array<double, 128> _ascii_widths{}; ///< The widths of all ASCII characters.
+		std::unordered_map<codepoint, double> _widths; ///< The widths of all other characters that have been used.
+		double
+			_font_size = 0.0, ///< The font size.
+			_advance = 0.0; ///< The width of a single-width character.
+		bool _monospace = false; ///< Indicates whether the primary font is fixed-pitch.
+
+		/// Measures the given character using the first font that contains it, or the primary font if there's
+		/// no such font.
+		double _measure(codepoint cp) const {
+			for (const auto &font : _fonts) {
+				if (font->has_character(cp)) {
+					return font->get_character_width_em(cp) * _font_size;
+				}
+			}
+			return _fonts.front()->get_character_width_em(cp) * _font_size;
+		}
+	};
+
+
 	/// A standalone component that gathers information about carets to be rendered later.
 	struct caret_gatherer {
 	public:
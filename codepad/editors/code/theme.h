@@ -6,6 +6,9 @@
 /// \file
 /// Classes used to record and manage font color, style, etc. in a \ref codepad::editors::code::interpretation.
 
+#include <optional>
+
+#include "../../core/bst.h"
 #include "../../ui/renderer.h"
 
 namespace codepad::editors::code {
@@ -17,81 +20,263 @@ namespace codepad::editors::code {
 		text_theme_specification(colord c, ui::font_style st, ui::font_weight w) : color(c), style(st), weight(w) {
 		}
 
+		/// Equality.
+		friend bool operator==(const text_theme_specification &lhs, const text_theme_specification &rhs) {
+			return lhs.color == rhs.color && lhs.style == rhs.style && lhs.weight == rhs.weight;
+		}
+		/// Inequality.
+		friend bool operator!=(const text_theme_specification &lhs, const text_theme_specification &rhs) {
+			return !(lhs == rhs);
+		}
+
 		colord color; ///< The color of the text.
 		ui::font_style style = ui::font_style::normal; ///< The font style.
 		ui::font_weight weight = ui::font_weight::normal; ///< The font weight.
 	};
 	/// Records a parameter of the theme of the entire buffer. Internally, it keeps a list of
-	/// (position, value) pairs, and characters will use the last value specified before it.
+	/// (position, value) pairs, and characters will use the last value specified before it. The pairs are stored
+	/// in a \ref binary_tree with positions relative to the previous pair, so that edits can shift all following
+	/// pairs in logarithmic time.
 	template <typename T> class text_theme_parameter_info {
+	protected:
+		/// A position-value pair stored in the tree.
+		struct pair_data {
+			/// Default constructor.
+			pair_data() = default;
+			/// Initializes all fields of this struct.
+			pair_data(std::size_t off, T v) : offset(off), value(std::move(v)) {
+			}
+
+			/// The distance between the position of the previous pair and that of this pair. This is always 0 for the
+			/// first pair.
+			std::size_t offset = 0;
+			T value{}; ///< The value of the parameter.
+		};
+		/// Contains additional synthesized data of a subtree.
+		struct pair_synth_data {
+			/// A node in the tree.
+			using node_type = binary_tree_node<pair_data, pair_synth_data>;
+
+			std::size_t
+				total_offset = 0, ///< The sum of \ref pair_data::offset of all pairs in this subtree.
+				num_pairs = 0; ///< The number of pairs in this subtree.
+
+			using offset_property = sum_synthesizer::compact_property<
+				synthesization_helper::field_value_property<&pair_data::offset>,
+				&pair_synth_data::total_offset
+			>; ///< Property used to obtain the positions of pairs.
+			using num_pairs_property = sum_synthesizer::compact_property<
+				synthesization_helper::identity, &pair_synth_data::num_pairs
+			>; ///< Property used to obtain the number of pairs.
+
+			/// Calls \ref sum_synthesizer::synthesize to update the stored values.
+			inline static void synthesize(node_type &n) {
+				sum_synthesizer::synthesize<offset_property, num_pairs_property>(n);
+			}
+		};
+		/// The type of the tree used to store the pairs.
+		using tree_type = binary_tree<pair_data, pair_synth_data>;
+		using node_type = typename tree_type::node; ///< The type of a node in \ref tree_type.
 	public:
-		/// Iterator.
-		using iterator = typename std::map<std::size_t, T>::iterator;
-		/// Const iterator.
-		using const_iterator = typename std::map<std::size_t, T>::const_iterator;
+		/// Iterator through the position-value pairs that also keeps track of the absolute position of the pair.
+		struct const_iterator {
+			friend text_theme_parameter_info;
+		public:
+			/// Default constructor.
+			const_iterator() = default;
+
+			/// Moves to the next pair.
+			const_iterator &operator++() {
+				++_it;
+				if (_it != _it.get_container()->end()) {
+					_pos += _it->offset;
+				}
+				return *this;
+			}
+			/// Post-increment.
+			const_iterator operator++(int) {
+				const_iterator res = *this;
+				++*this;
+				return res;
+			}
+			/// Moves to the previous pair.
+			const_iterator &operator--() {
+				if (_it != _it.get_container()->end()) {
+					_pos -= _it->offset;
+				}
+				--_it;
+				return *this;
+			}
+			/// Post-decrement.
+			const_iterator operator--(int) {
+				const_iterator res = *this;
+				--*this;
+				return res;
+			}
+
+			/// Equality.
+			friend bool operator==(const const_iterator &lhs, const const_iterator &rhs) {
+				return lhs._it == rhs._it;
+			}
+			/// Inequality.
+			friend bool operator!=(const const_iterator &lhs, const const_iterator &rhs) {
+				return !(lhs == rhs);
+			}
+
+			/// Returns the position of this pair.
+			std::size_t get_position() const {
+				return _pos;
+			}
+			/// Returns the value of this pair.
+			const T &get_value() const {
+				return _it->value;
+			}
+		protected:
+			/// Initializes all fields of this struct.
+			const_iterator(typename tree_type::const_iterator it, std::size_t pos) : _it(it), _pos(pos) {
+			}
+
+			typename tree_type::const_iterator _it; ///< Iterator to the node in the tree.
+			/// The position of this pair. For iterators past the last pair, this is the position of the last pair.
+			std::size_t _pos = 0;
+		};
 
 		/// Default constructor. Adds a default-initialized value to position 0.
 		text_theme_parameter_info() : text_theme_parameter_info(T()) {
 		}
 		/// Constructor that adds the given value to position 0.
 		explicit text_theme_parameter_info(T def) {
-			_changes.emplace(0, std::move(def));
+			_t.emplace_before(_t.end(), 0, std::move(def));
 		}
 
 		/// Clears the parameter of the theme, and adds the given value to position 0.
 		void clear(T def) {
-			_changes.clear();
-			_changes[0] = def;
+			_t.clear();
+			_t.emplace_before(_t.end(), 0, std::move(def));
 		}
 		/// Sets the parameter of the given range to the given value.
 		void set_range(std::size_t s, std::size_t pe, T c) {
 			assert_true_usage(s < pe, "invalid range");
-			auto beg = get_iter_at(s), end = get_iter_at(pe);
-			T begv = beg->second, endv = end->second;
-			_changes.erase(++beg, ++end);
-			if (begv != c) {
-				_changes[s] = c;
+			std::pair<std::size_t, T> run(pe - s, std::move(c));
+			replace_range(s, &run, &run + 1);
+		}
+		/// Replaces the parameter of all characters starting from \p s with the given list of runs, each of which is
+		/// a \p std::pair of its length and its value. Characters after the runs are not affected. This is more
+		/// efficient than calling \ref set_range() for each run.
+		template <typename It> void replace_range(std::size_t s, It beg, It end) {
+			std::size_t pe = s;
+			for (It it = beg; it != end; ++it) {
+				pe += it->first;
+			}
+			if (pe == s) {
+				return;
 			}
-			if (endv != c) {
-				_changes[pe] = endv;
+			T endv = get_at(pe);
+			// find all pairs in [s, pe]
+			std::size_t lower_offset = s, upper_offset = pe;
+			typename tree_type::const_iterator lower = _t.find_custom(_pair_at_or_after_finder(), lower_offset);
+			typename tree_type::const_iterator upper = _t.find_custom(_pair_after_finder(), upper_offset);
+			std::size_t lastpos = s - lower_offset, upperpos = pe - upper_offset;
+			if (upper != _t.end()) {
+				upperpos += upper->offset;
+			}
+			std::optional<T> lastv;
+			if (lower != _t.begin()) {
+				auto prev = lower;
+				lastv.emplace((--prev)->value);
+			}
+			// generate new pairs
+			std::vector<pair_data> pairs;
+			auto append = [&](std::size_t pos, const T &v) {
+				if (!lastv.has_value() || lastv.value() != v) {
+					pairs.emplace_back(pos - lastpos, v);
+					lastpos = pos;
+					lastv.emplace(v);
+				}
+			};
+			for (std::size_t pos = s; beg != end; pos += beg->first, ++beg) {
+				if (beg->first > 0) {
+					append(pos, beg->second);
+				}
+			}
+			append(pe, endv);
+			// replace old pairs
+			_t.erase(lower, upper);
+			_t.insert_range_before_move(upper, pairs.begin(), pairs.end());
+			if (upper != _t.end()) {
+				_t.get_modifier_for(upper.get_node())->offset = upperpos - lastpos;
 			}
 		}
 		/// Retrieves the value of the parameter at the given position.
 		T get_at(std::size_t cp) const {
-			return get_iter_at(cp)->second;
+			return get_iter_at(cp).get_value();
+		}
+		/// Adjusts the positions of all pairs after a modification. Newly inserted characters take the value at
+		/// \p pos before the modification. Only the pairs in the modified range are visited; all following pairs
+		/// are shifted by updating the offset of a single pair.
+		///
+		/// \param pos The position of the modification.
+		/// \param removed The number of removed characters.
+		/// \param added The number of inserted characters.
+		void on_modification(std::size_t pos, std::size_t removed, std::size_t added) {
+			if (removed == 0 && added == 0) {
+				return;
+			}
+			T endv = get_at(pos + removed);
+			// find all pairs in (pos, pos + removed], or [pos, pos + removed] if no character is inserted
+			std::size_t lower_offset = pos, upper_offset = pos + removed;
+			typename tree_type::const_iterator lower =
+				added == 0 ?
+				_t.find_custom(_pair_at_or_after_finder(), lower_offset) :
+				_t.find_custom(_pair_after_finder(), lower_offset);
+			typename tree_type::const_iterator upper = _t.find_custom(_pair_after_finder(), upper_offset);
+			std::size_t lastpos = pos - lower_offset, upperpos = pos + removed - upper_offset;
+			if (upper != _t.end()) {
+				upperpos += upper->offset;
+			}
+			bool split = true;
+			if (lower != _t.begin()) {
+				auto prev = lower;
+				split = (--prev)->value != endv;
+			}
+			_t.erase(lower, upper);
+			if (split) {
+				_t.emplace_before(upper, pos + added - lastpos, std::move(endv));
+				lastpos = pos + added;
+			}
+			if (upper != _t.end()) {
+				_t.get_modifier_for(upper.get_node())->offset = upperpos + added - removed - lastpos;
+			}
 		}
 
 		/// Returns an iterator to the first pair.
-		iterator begin() {
-			return _changes.begin();
-		}
-		/// Returns an iterator past the last pair.
-		iterator end() {
-			return _changes.end();
-		}
-		/// Returns an iterator to the pair that determines the parameter at the given position.
-		iterator get_iter_at(std::size_t cp) {
-			return --_changes.upper_bound(cp);
-		}
-		/// Const version of \ref begin().
 		const_iterator begin() const {
-			return _changes.begin();
+			return const_iterator(_t.begin(), 0);
 		}
-		/// Const version of \ref end().
+		/// Returns an iterator past the last pair.
 		const_iterator end() const {
-			return _changes.end();
+			return const_iterator(_t.end(), _t.root()->synth_data.total_offset);
 		}
-		/// Const version of \ref get_iter_at(std::size_t).
+		/// Returns an iterator to the pair that determines the parameter at the given position.
 		const_iterator get_iter_at(std::size_t cp) const {
-			return --_changes.upper_bound(cp);
+			std::size_t offset = cp;
+			auto it = _t.find_custom(_pair_after_finder(), offset);
+			return const_iterator(--it, cp - offset); // the first pair is always at position 0
 		}
 
 		/// Returns the number of position-value pairs in this parameter.
 		std::size_t size() const {
-			return _changes.size();
+			return _t.root()->synth_data.num_pairs;
 		}
 	protected:
-		std::map<std::size_t, T> _changes; ///< The underlying \p std::map that stores the position-value pairs.
+		/// Used to find the first pair whose position is larger than the given position.
+		using _pair_after_finder = sum_synthesizer::index_finder<typename pair_synth_data::offset_property>;
+		/// Used to find the first pair whose position is larger than or equal to the given position.
+		using _pair_at_or_after_finder = sum_synthesizer::index_finder<
+			typename pair_synth_data::offset_property, false, std::less_equal<std::size_t>
+		>;
+
+		tree_type _t; ///< The underlying \ref binary_tree that stores the position-value pairs.
 	};
 
 	/// Bitfield indicating specific parameters of the text's theme.
@@ -111,31 +296,26 @@ namespace codepad {
 }
 
 namespace codepad::editors::code {
-	/// Records the text's theme across the entire buffer.
+	/// Records the text's theme across the entire buffer. All parameters are stored together as a single list of
+	/// runs, with one pair for each position where any parameter changes.
 	struct text_theme_data {
-		text_theme_parameter_info<colord> color; ///< Records the text's color across the ehtire buffer.
-		text_theme_parameter_info<ui::font_style> style; ///< Records the text's style across the entire buffer.
-		text_theme_parameter_info<ui::font_weight> weight; ///< Records the text's weight across the entire buffer.
+		/// The type used to store the runs.
+		using runs_type = text_theme_parameter_info<text_theme_specification>;
+
+		runs_type runs; ///< Records the text's theme across the entire buffer.
 
 		/// An iterator used to obtain the theme of the text at a certain position. This should only be used
 		/// temporarily when the associated \ref text_theme_data isn't changing.
 		struct char_iterator {
 			/// Default constructor.
 			char_iterator() = default;
-			/// Initializes \ref current_theme from the given iterators, then initializes all \p next_* iterators by
-			/// incrementing the given ones.
+			/// Initializes \ref current_theme from the run at the given position, then initializes \ref _next to
+			/// the run after it.
 			char_iterator(const text_theme_data &data, std::size_t position) :
-				_next_color(data.color.get_iter_at(position)),
-				_next_style(data.style.get_iter_at(position)),
-				_next_weight(data.weight.get_iter_at(position)),
-				_data(&data) {
+				_next(data.runs.get_iter_at(position)), _data(&data) {
 
-				current_theme = text_theme_specification(
-					_next_color->second, _next_style->second, _next_weight->second
-				);
-				++_next_color;
-				++_next_style;
-				++_next_weight;
+				current_theme = _next.get_value();
+				++_next;
 			}
 
 			/// Moves the given \ref char_iterator to the given position. The position must be after where this
@@ -143,88 +323,67 @@ namespace codepad::editors::code {
 			///
 			/// \return All members that have potentially changed.
 			text_theme_member move_forward(std::size_t pos) {
+				if (_next == _data->runs.end() || _next.get_position() > pos) {
+					return text_theme_member::none;
+				}
+				++_next; // fast case: only need to increment once
+				if (_next != _data->runs.end() && _next.get_position() <= pos) { // slow: reposition
+					_next = _data->runs.get_iter_at(pos);
+					++_next;
+				}
+				auto cur = _next;
+				const text_theme_specification &newtheme = (--cur).get_value();
 				text_theme_member result = text_theme_member::none;
-				if (_move_iter_forward(_next_color, _data->color, current_theme.color, pos)) {
+				if (newtheme.color != current_theme.color) {
 					result |= text_theme_member::color;
 				}
-				if (_move_iter_forward(_next_style, _data->style, current_theme.style, pos)) {
+				if (newtheme.style != current_theme.style) {
 					result |= text_theme_member::style;
 				}
-				if (_move_iter_forward(_next_weight, _data->weight, current_theme.weight, pos)) {
+				if (newtheme.weight != current_theme.weight) {
 					result |= text_theme_member::weight;
 				}
+				current_theme = newtheme;
 				return result;
 			}
 			/// Returns the number of characters to the next change of any parameter, given the current position.
 			std::size_t forecast(std::size_t pos) const {
-				std::size_t res = _forecast_iter(_next_color, _data->color, pos);
-				res = std::min(res, _forecast_iter(_next_style, _data->style, pos));
-				res = std::min(res, _forecast_iter(_next_weight, _data->weight, pos));
-				return res;
+				if (_next != _data->runs.end()) {
+					return _next.get_position() - pos;
+				}
+				return std::numeric_limits<std::size_t>::max();
 			}
 
 			text_theme_specification current_theme; ///< The current theme of the text.
 		protected:
-			/// The iterator to the next position-color pair.
-			text_theme_parameter_info<colord>::const_iterator _next_color;
-			/// The iterator to the next position-\ref ui::font_style pair.
-			text_theme_parameter_info<ui::font_style>::const_iterator _next_style;
-			/// The iterator to the next position-\ref ui::font_weight pair.
-			text_theme_parameter_info<ui::font_weight>::const_iterator _next_weight;
+			runs_type::const_iterator _next; ///< The iterator to the next run.
 			const text_theme_data *_data = nullptr; ///< The associated \ref text_theme_data.
-
-			/// Called by \ref move_forward(). Increments a \ref text_theme_parameter_info::const_iterator if
-			/// necessary.
-			///
-			/// \param it The iterator.
-			/// \param spec The set of position-value pairs.
-			/// \param val The value at the position.
-			/// \param pos The new position in the text.
-			/// \return \p true if the iterator has been moved.
-			template <typename T> inline static bool _move_iter_forward(
-				typename text_theme_parameter_info<T>::const_iterator &it,
-				const text_theme_parameter_info<T> &spec, T &val, std::size_t pos
-			) {
-				if (it != spec.end() && it->first <= pos) { // fast case: only need to increment once
-					val = it->second;
-					++it;
-					if (it != spec.end() && it->first <= pos) { // slow: reposition
-						it = spec.get_iter_at(pos);
-						val = it->second;
-						++it;
-					}
-					return true;
-				}
-				return false;
-			}
-
-			/// \ref forecast() for a single parameter.
-			template <typename T> inline static std::size_t _forecast_iter(
-				const typename text_theme_parameter_info<T>::const_iterator &it,
-				const text_theme_parameter_info<T> &spec, std::size_t pos
-			) {
-				if (it != spec.end()) {
-					return it->first - pos;
-				}
-				return std::numeric_limits<std::size_t>::max();
-			}
 		};
 
 		/// Sets the theme of the text in the given range.
 		void set_range(std::size_t s, std::size_t pe, text_theme_specification tc) {
-			color.set_range(s, pe, tc.color);
-			style.set_range(s, pe, tc.style);
-			weight.set_range(s, pe, tc.weight);
+			runs.set_range(s, pe, tc);
+		}
+		/// Replaces the theme of all text starting from \p s with the given list of runs, each of which is a
+		/// \p std::pair of its length and its theme.
+		///
+		/// \sa text_theme_parameter_info::replace_range()
+		template <typename It> void replace_range(std::size_t s, It beg, It end) {
+			runs.replace_range(s, std::move(beg), std::move(end));
 		}
 		/// Returns the theme of the text at the given position.
 		text_theme_specification get_at(std::size_t p) const {
-			return text_theme_specification(color.get_at(p), style.get_at(p), weight.get_at(p));
+			return runs.get_at(p);
+		}
+		/// Adjusts the theme after a modification has been made to the text.
+		///
+		/// \sa text_theme_parameter_info::on_modification()
+		void on_modification(std::size_t pos, std::size_t removed, std::size_t added) {
+			runs.on_modification(pos, removed, added);
 		}
 		/// Sets the theme of all text to the given value.
 		void clear(const text_theme_specification &def) {
-			color.clear(def.color);
-			style.clear(def.style);
-			weight.clear(def.weight);
+			runs.clear(def);
 		}
 	};
 }
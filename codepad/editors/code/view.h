@@ -6,6 +6,8 @@
 /// \file
 /// Contains classes used to format a view of a \ref codepad::editors::code::interpretation.
 
+#include <limits>
+
 #include "interpretation.h"
 
 namespace codepad::editors::code {
@@ -198,6 +200,25 @@ namespace codepad::editors::code {
 			}
 			_t = tree_type(vs.begin(), vs.end());
 		}
+		/// Replaces all soft linebreaks in the given range of characters with the given ones, without affecting
+		/// soft linebreaks outside of the range.
+		///
+		/// \param beg The beginning of the range.
+		/// \param end The end of the range. Soft linebreaks at this position are not removed.
+		/// \param poss The new list of soft linebreaks' positions in the range, sorted in increasing order.
+		/// \return The number of soft linebreaks that have been removed.
+		std::size_t replace_softbreaks(std::size_t beg, std::size_t end, const std::vector<std::size_t> &poss) {
+			return _splice(beg, end, poss, 0, 0);
+		}
+		/// Adjusts the positions of soft linebreaks after a modification. Soft linebreaks in the removed range are
+		/// removed, and all soft linebreaks after the removed range are shifted.
+		///
+		/// \param pos The position of the modification.
+		/// \param removed The number of removed characters.
+		/// \param added The number of inserted characters.
+		void on_modification(std::size_t pos, std::size_t removed, std::size_t added) {
+			_splice(pos + 1, pos + removed + 1, {}, removed, added);
+		}
 
 		/// Returns the total number of soft linebreaks.
 		std::size_t num_softbreaks() const {
@@ -224,10 +245,57 @@ namespace codepad::editors::code {
 			}
 			std::size_t num_softbreaks = 0; ///< Records the number of soft linebreaks before the resulting node.
 		};
+		/// Used to find the first soft linebreak at or after a given position, and the number of soft linebreaks
+		/// before it.
+		struct _get_softbreaks_before_or_at {
+			/// The underlying \ref sum_synthesizer::index_finder.
+			using finder = sum_synthesizer::index_finder<
+				node_synth_data::length_property, false, std::less_equal<std::size_t>
+			>;
+			/// Interface to binary_tree::find_custom.
+			int select_find(node_type &n, std::size_t &target) {
+				return finder::template select_find<
+					node_synth_data::softbreaks_property
+				>(n, target, num_softbreaks);
+			}
+			std::size_t num_softbreaks = 0; ///< Records the number of soft linebreaks before the resulting node.
+		};
 
 		tree_type _t; ///< The underlying \ref binary_tree that records all soft linebreaks.
 		const linebreak_registry *_reg = nullptr; ///< The associated \ref linebreak_registry.
 
+		/// Removes all soft linebreaks in the range <tt>[beg, end)</tt>, inserts the given soft linebreaks, then
+		/// shifts all soft linebreaks after the range by <tt>added - removed</tt> characters.
+		///
+		/// \return The number of soft linebreaks that have been removed.
+		std::size_t _splice(
+			std::size_t beg, std::size_t end, const std::vector<std::size_t> &poss,
+			std::size_t removed, std::size_t added
+		) {
+			_get_softbreaks_before_or_at lower_sel, upper_sel;
+			std::size_t lower_offset = beg, upper_offset = end;
+			iterator
+				lower = _t.find_custom(lower_sel, lower_offset),
+				upper = _t.find_custom(upper_sel, upper_offset);
+			std::size_t last = beg - lower_offset, upperpos = end - upper_offset;
+			if (upper != _t.end()) {
+				upperpos += upper->length;
+			}
+			std::vector<node_data> vs;
+			vs.reserve(poss.size());
+			for (std::size_t cp : poss) {
+				assert_true_usage(cp > last && cp < end, "softbreak list not properly sorted");
+				vs.emplace_back(cp - last);
+				last = cp;
+			}
+			_t.erase(lower, upper);
+			_t.insert_range_before_move(upper, vs.begin(), vs.end());
+			if (upper != _t.end()) {
+				auto mod = _t.get_modifier_for(upper.get_node());
+				mod->length = upperpos + added - removed - last;
+			}
+			return upper_sel.num_softbreaks - lower_sel.num_softbreaks;
+		}
 
 		/// Obtains information about the visual line at the given position. For the visual line with the given
 		/// line number, it returns two iterators, one to a soft `segment' and one to a hard `segment', that contain
@@ -816,6 +884,354 @@ namespace codepad::editors::code {
 		bool _bytepos_valid = false; ///< Whether the underlying byte positions are valid.
 	};
 
+	/// Records the beginning and the span of all visual lines of a view, with both soft linebreaks and folded
+	/// regions taken into account, so that conversions between visual lines and characters can be done with a
+	/// single lookup. The contents of this registry are derived from a \ref soft_linebreak_registry and a
+	/// \ref folding_registry, and should be updated with \ref rebuild() or \ref refresh() whenever they change.
+	class visual_line_registry {
+	public:
+		/// Stores information about a single visual line.
+		struct node_data {
+			/// Default constructor.
+			node_data() = default;
+			/// Initializes all fields of this struct.
+			node_data(std::size_t len, std::size_t lines, linebreak_type t) :
+				length(len), unfolded_lines(lines), type(t) {
+			}
+
+			/// The number of characters between the beginning of this line and the beginning of the next line,
+			/// including all folded characters.
+			std::size_t length = 0;
+			/// The number of visual lines that this line would span if there were no folded regions.
+			std::size_t unfolded_lines = 1;
+			linebreak_type type = linebreak_type::hard; ///< The type of the linebreak before this line.
+		};
+		/// Stores additional synthesized data of a subtree.
+		struct node_synth_data {
+			/// The type of a node.
+			using node_type = binary_tree_node<node_data, node_synth_data>;
+
+			std::size_t
+				total_length = 0, ///< The total number of characters in the subtree.
+				total_unfolded_lines = 0, ///< The total number of visual lines in the subtree if nothing is folded.
+				tree_size = 0; ///< The total number of visual lines in the subtree.
+
+			using length_property = sum_synthesizer::compact_property<
+				synthesization_helper::field_value_property<&node_data::length>,
+				&node_synth_data::total_length
+			>; ///< Property used to obtain the total number of characters in a subtree.
+			/// Property used to obtain the total number of visual lines in a subtree if nothing is folded.
+			using unfolded_lines_property = sum_synthesizer::compact_property<
+				synthesization_helper::field_value_property<&node_data::unfolded_lines>,
+				&node_synth_data::total_unfolded_lines
+			>;
+			using tree_size_property = sum_synthesizer::compact_property<
+				synthesization_helper::identity, &node_synth_data::tree_size
+			>; ///< Property used to obtain the total number of visual lines in a subtree.
+
+			/// Calls \ref sum_synthesizer::synthesize to update the recorded values.
+			inline static void synthesize(node_type &n) {
+				sum_synthesizer::synthesize<length_property, unfolded_lines_property, tree_size_property>(n);
+			}
+		};
+		/// The type of the tree.
+		using tree_type = binary_tree<node_data, node_synth_data>;
+		/// The type of a node in the tree.
+		using node_type = typename tree_type::node;
+		/// Const iterators to elements in the tree.
+		using iterator = typename tree_type::const_iterator;
+
+		/// Used to wrap up the results of a query.
+		struct line_info {
+			/// Default constructor.
+			line_info() = default;
+			/// Initializes all fields of this struct.
+			line_info(const iterator &it, std::size_t fc, std::size_t ul) :
+				entry(it), first_char(fc), unfolded_line(ul) {
+			}
+
+			iterator entry; ///< Iterator to the visual line.
+			std::size_t
+				first_char = 0, ///< The first character of the visual line.
+				unfolded_line = 0; ///< The index of the same line if nothing is folded.
+		};
+
+		/// Returns information about the given visual line. If the line is past the end of the document,
+		/// \ref line_info::entry will be \ref end() and \ref line_info::first_char will be the number of
+		/// characters in the document.
+		line_info get_line_info(std::size_t line) const {
+			_line_finder finder;
+			std::size_t target = line;
+			iterator it = _t.find_custom(finder, target);
+			if (it == _t.end()) {
+				finder.total_unfolded_lines += target;
+			}
+			return line_info(it, finder.total_chars, finder.total_unfolded_lines);
+		}
+		/// Returns the position of the given line's beginning and the type of the linebreak before the line.
+		std::pair<std::size_t, linebreak_type> get_beginning_char_of_visual_line(std::size_t line) const {
+			line_info info = get_line_info(line);
+			return {info.first_char, info.entry == _t.end() ? linebreak_type::hard : info.entry->type};
+		}
+		/// Given a line index in the document with folding enabled, returns the index of the same line when
+		/// folding is disabled.
+		std::size_t folded_to_unfolded_line_number(std::size_t line) const {
+			return get_line_info(line).unfolded_line;
+		}
+		/// Returns the visual line that the given character is on, and information about that line. Characters
+		/// that are folded belong to the line that contains the folded region. If the character is at the
+		/// beginning of a line, that line is returned.
+		std::pair<std::size_t, line_info> get_line_info_of_char(std::size_t c) const {
+			_char_finder finder;
+			std::size_t offset = c;
+			iterator it = _t.find_custom(finder, offset);
+			if (it == _t.end() && it != _t.begin()) { // past the end, use the last line
+				--it;
+				offset += it->length;
+				--finder.total_lines;
+				finder.total_unfolded_lines -= it->unfolded_lines;
+			}
+			return {finder.total_lines, line_info(it, c - offset, finder.total_unfolded_lines)};
+		}
+		/// Returns the visual line that the given character is on.
+		///
+		/// \sa get_line_info_of_char()
+		std::size_t get_visual_line_of_char(std::size_t c) const {
+			return get_line_info_of_char(c).first;
+		}
+
+		/// Returns the total number of visual lines.
+		std::size_t num_visual_lines() const {
+			return _t.root() ? _t.root()->synth_data.tree_size : 0;
+		}
+		/// Returns the total number of characters.
+		std::size_t num_chars() const {
+			return _t.root() ? _t.root()->synth_data.total_length : 0;
+		}
+
+		/// Returns an iterator to the first visual line.
+		iterator begin() const {
+			return _t.begin();
+		}
+		/// Returns an iterator past the last visual line.
+		iterator end() const {
+			return _t.end();
+		}
+
+		/// Recalculates all visual lines.
+		void rebuild(const soft_linebreak_registry &lbr, const folding_registry &fr) {
+			std::vector<node_data> nodes;
+			_line_generator gen(lbr, fr, 0);
+			do {
+				nodes.emplace_back(gen.next());
+			} while (!gen.at_end());
+			_t = tree_type(nodes.begin(), nodes.end());
+		}
+		/// Recalculates visual lines after the soft linebreaks or folded regions in the range of characters
+		/// <tt>[beg, oldend)</tt> have been modified, which now span <tt>[beg, newend)</tt>. Visual lines are
+		/// regenerated starting from the line before \p beg, until a linebreak after \p newend is found that
+		/// coincides with an existing linebreak after \p oldend. If no such linebreak is found before
+		/// \p limit, this registry is not modified.
+		///
+		/// \return Whether this registry has been updated.
+		bool refresh(
+			const soft_linebreak_registry &lbr, const folding_registry &fr,
+			std::size_t beg, std::size_t oldend, std::size_t newend,
+			std::size_t limit = std::numeric_limits<std::size_t>::max()
+		) {
+			if (_t.empty()) {
+				rebuild(lbr, fr);
+				return true;
+			}
+			// start from the line before beg, since the linebreak at beg may have been removed
+			_char_finder finder;
+			std::size_t anchor = beg > 0 ? beg - 1 : 0, offset = anchor;
+			iterator first = _t.find_custom(finder, offset);
+			if (first == _t.end()) {
+				--first;
+				offset += first->length;
+			}
+			std::size_t pos = anchor - offset, oldpos = pos;
+			iterator oldit = first;
+			std::vector<node_data> nodes;
+			_line_generator gen(lbr, fr, pos);
+			while (true) {
+				nodes.emplace_back(gen.next());
+				std::size_t newpos = gen.get_position();
+				// consume all old lines that end before this line; old lines that end at the same position are
+				// also consumed, if the positions after the modified range coincide
+				while (oldit != _t.end()) {
+					std::size_t oldlineend = oldpos + oldit->length;
+					if (oldlineend >= oldend && oldlineend + newend >= newpos + oldend) {
+						break;
+					}
+					oldpos = oldlineend;
+					++oldit;
+				}
+				if (oldit != _t.end() && newpos >= newend) {
+					std::size_t oldlineend = oldpos + oldit->length;
+					iterator oldnext = oldit;
+					++oldnext;
+					// the end of the document is not a linebreak, and only matches itself
+					if (oldlineend + newend == newpos + oldend && (oldnext == _t.end()) == gen.at_end()) { // found
+						oldit = oldnext;
+						break;
+					}
+				}
+				if (newpos >= limit) {
+					return false;
+				}
+				if (gen.at_end()) {
+					oldit = _t.end();
+					break;
+				}
+			}
+			_t.erase(first, oldit);
+			_t.insert_range_before_move(oldit, nodes.begin(), nodes.end());
+			return true;
+		}
+	protected:
+		/// Used to find a visual line by its index.
+		struct _line_finder {
+			/// The underlying \ref sum_synthesizer::index_finder.
+			using finder = sum_synthesizer::index_finder<node_synth_data::tree_size_property>;
+			/// Interface to binary_tree::find_custom.
+			int select_find(const node_type &n, std::size_t &target) {
+				return finder::template select_find<
+					node_synth_data::length_property, node_synth_data::unfolded_lines_property
+				>(n, target, total_chars, total_unfolded_lines);
+			}
+			std::size_t
+				total_chars = 0, ///< The number of characters before the resulting line.
+				total_unfolded_lines = 0; ///< The number of unfolded visual lines before the resulting line.
+		};
+		/// Used to find the visual line that contains a given character.
+		struct _char_finder {
+			/// The underlying \ref sum_synthesizer::index_finder.
+			using finder = sum_synthesizer::index_finder<node_synth_data::length_property>;
+			/// Interface to binary_tree::find_custom.
+			int select_find(const node_type &n, std::size_t &target) {
+				return finder::template select_find<
+					node_synth_data::tree_size_property, node_synth_data::unfolded_lines_property
+				>(n, target, total_lines, total_unfolded_lines);
+			}
+			std::size_t
+				total_lines = 0, ///< The number of visual lines before the resulting line.
+				total_unfolded_lines = 0; ///< The number of unfolded visual lines before the resulting line.
+		};
+
+		/// Generates visual lines from a \ref soft_linebreak_registry and a \ref folding_registry by iterating
+		/// through hard linebreaks, soft linebreaks, and folded regions simultaneously.
+		struct _line_generator {
+		public:
+			/// Initializes all iterators. The given position must be at the beginning of a visual line.
+			_line_generator(const soft_linebreak_registry &lbr, const folding_registry &fr, std::size_t pos) :
+				_lbr(lbr), _fr(fr), _pos(pos) {
+				const linebreak_registry &reg = _lbr.get_hard_linebreaks();
+				linebreak_registry::line_column_info hard = reg.get_line_and_column_of_char(_pos);
+				_hard = hard.line_iterator;
+				_type = hard.position_in_line == 0 ? linebreak_type::hard : linebreak_type::soft;
+				_hard_next = _pos - hard.position_in_line;
+				_update_hard_next();
+				soft_linebreak_registry::softbreak_info soft = _lbr.get_softbreak_before_or_at_char(_pos);
+				_soft = soft.entry;
+				_soft_next = soft.prev_chars;
+				_update_soft_next();
+				folding_registry::fold_region_info fold = _fr.find_region_containing_or_first_after_open(_pos);
+				_fold = fold.entry;
+				_fold_end = fold.prev_chars;
+				_update_fold();
+			}
+
+			/// Returns the visual line that starts at the current position, and moves to the next line.
+			node_data next() {
+				std::size_t unfolded = 1;
+				while (true) {
+					std::size_t next = std::min(_hard_next, _soft_next);
+					if (next == _none) { // last line
+						node_data res(_lbr.get_hard_linebreaks().num_chars() - _pos, unfolded, _type);
+						_pos += res.length;
+						_end = true;
+						return res;
+					}
+					linebreak_type type = linebreak_type::soft;
+					// if a soft linebreak coincides with a hard one, they're treated as two linebreaks
+					if (_hard_next == next) {
+						type = linebreak_type::hard;
+						++_hard;
+						_update_hard_next();
+					} else {
+						++_soft;
+						_update_soft_next();
+					}
+					while (_fold != _fr.end() && _fold_end < next) {
+						++_fold;
+						_update_fold();
+					}
+					if (_fold != _fr.end() && _fold_begin < next) { // hidden by the folded region
+						++unfolded;
+						continue;
+					}
+					node_data res(next - _pos, unfolded, _type);
+					_pos = next;
+					_type = type;
+					return res;
+				}
+			}
+
+			/// Returns the beginning of the next visual line.
+			std::size_t get_position() const {
+				return _pos;
+			}
+			/// Returns whether the last visual line has been generated.
+			bool at_end() const {
+				return _end;
+			}
+		protected:
+			/// Placeholder for positions after the end of the document.
+			constexpr static std::size_t _none = std::numeric_limits<std::size_t>::max();
+
+			const soft_linebreak_registry &_lbr; ///< The source of soft and hard linebreaks.
+			const folding_registry &_fr; ///< The source of folded regions.
+			linebreak_registry::iterator _hard; ///< Iterator to the current hard line.
+			soft_linebreak_registry::iterator _soft; ///< Iterator to the next soft linebreak.
+			folding_registry::iterator _fold; ///< Iterator to the first folded region that ends after \ref _pos.
+			std::size_t
+				_pos = 0, ///< The beginning of the current visual line.
+				_hard_next = 0, ///< The beginning of the line after \ref _hard.
+				_soft_next = 0, ///< The position of the soft linebreak that \ref _soft points to.
+				_fold_begin = 0, ///< The beginning of \ref _fold.
+				_fold_end = 0; ///< The end of \ref _fold.
+			linebreak_type _type = linebreak_type::hard; ///< The type of the linebreak before \ref _pos.
+			bool _end = false; ///< Whether the last line has been generated.
+
+			/// Updates \ref _hard_next after \ref _hard has been moved to the next line. Before this function is
+			/// called, \ref _hard_next should be the beginning of \ref _hard.
+			void _update_hard_next() {
+				if (_hard == _lbr.get_hard_linebreaks().end() || _hard->ending == line_ending::none) {
+					_hard_next = _none;
+				} else {
+					_hard_next += _hard->nonbreak_chars + 1;
+				}
+			}
+			/// Updates \ref _soft_next after \ref _soft has been moved to the next soft linebreak. Before this
+			/// function is called, \ref _soft_next should be the position of the previous soft linebreak.
+			void _update_soft_next() {
+				_soft_next = _soft == _lbr.end() ? _none : _soft_next + _soft->length;
+			}
+			/// Updates \ref _fold_begin and \ref _fold_end after \ref _fold has been moved to the next folded
+			/// region. Before this function is called, \ref _fold_end should be the end of the previous region.
+			void _update_fold() {
+				if (_fold != _fr.end()) {
+					_fold_begin = _fold_end + _fold->gap;
+					_fold_end = _fold_begin + _fold->range;
+				}
+			}
+		};
+
+		tree_type _t; ///< The underlying \ref binary_tree.
+	};
+
 	/// Controls the formatting of a single view of a document. This is different for each view of the same
 	/// opened document.
 	class view_formatting {
@@ -826,6 +1242,7 @@ namespace codepad::editors::code {
 		view_formatting() = default;
 		/// Initializes \ref _lbr with the given \ref linebreak_registry.
 		explicit view_formatting(const linebreak_registry &reg) : _lbr(reg) {
+			_vlr.rebuild(_lbr, _fr);
 		}
 		/// Initializes this class with the corresponding \ref interpretation.
 		explicit view_formatting(const interpretation &interp) : view_formatting(interp.get_linebreaks()) {
@@ -835,11 +1252,23 @@ namespace codepad::editors::code {
 		void set_softbreaks(const std::vector<std::size_t> &breaks) {
 			_lbr.set_softbreaks(breaks);
 			recalc_foldreg_lines();
+			_vlr.rebuild(_lbr, _fr);
 		}
 		/// Clears all soft linebreaks of this view.
 		void clear_softbreaks() {
 			_lbr.clear_softbreaks();
 			recalc_foldreg_lines();
+			_vlr.rebuild(_lbr, _fr);
+		}
+		/// Replaces the soft linebreaks of this view in the given range.
+		///
+		/// \return The number of soft linebreaks that have been removed.
+		/// \sa soft_linebreak_registry::replace_softbreaks()
+		std::size_t replace_softbreaks(std::size_t beg, std::size_t end, const std::vector<std::size_t> &breaks) {
+			std::size_t res = _lbr.replace_softbreaks(beg, end, breaks);
+			recalc_foldreg_lines(beg, end);
+			_vlr.refresh(_lbr, _fr, beg, end, end);
+			return res;
 		}
 
 		/// Folds the given region.
@@ -847,18 +1276,40 @@ namespace codepad::editors::code {
 		/// \return An iterator to the added entry in \ref _fr.
 		folding_registry::iterator add_folded_region(const fold_region &rgn) {
 			assert_true_usage(rgn.second > rgn.first, "invalid fold region");
-			return _fr.add_fold_region(folding_registry::fold_region_data(
+			folding_registry::iterator res = _fr.add_fold_region(folding_registry::fold_region_data(
 				rgn.first, rgn.second,
 				_lbr.get_visual_line_of_char(rgn.first), _lbr.get_visual_line_of_char(rgn.second)
 			));
+			_vlr.refresh(_lbr, _fr, rgn.first, rgn.second, rgn.second);
+			return res;
+		}
+		/// Folds all given regions, then rebuilds \ref _vlr once instead of refreshing it for each region.
+		void add_folded_regions(const std::vector<fold_region> &rgns) {
+			for (const fold_region &rgn : rgns) {
+				assert_true_usage(rgn.second > rgn.first, "invalid fold region");
+				_fr.add_fold_region(folding_registry::fold_region_data(
+					rgn.first, rgn.second,
+					_lbr.get_visual_line_of_char(rgn.first), _lbr.get_visual_line_of_char(rgn.second)
+				));
+			}
+			_vlr.rebuild(_lbr, _fr);
 		}
 		/// Unfolds the given region.
-		void remove_folded_region(folding_registry::iterator it) {
+		///
+		/// \return The region that has been unfolded.
+		fold_region remove_folded_region(folding_registry::iterator it) {
+			std::size_t beg = 0;
+			sum_synthesizer::sum_before<folding_registry::fold_region_synth_data::span_property>(it, beg);
+			beg += it->gap;
+			std::size_t end = beg + it->range;
 			_fr.remove_folded_region(it);
+			_vlr.refresh(_lbr, _fr, beg, end, end);
+			return fold_region(beg, end);
 		}
 		/// Unfolds all of the document.
 		void clear_folded_regions() {
 			_fr.clear_folded_regions();
+			_vlr.rebuild(_lbr, _fr);
 		}
 
 		/// Prepares this \ref view_formatting for modifications by calling \ref folding_registry::prepare_for_edit.
@@ -866,9 +1317,37 @@ namespace codepad::editors::code {
 			_fr.prepare_for_edit(interp);
 		}
 		/// Fixup this \ref view_formatting after the underlying \ref buffer has been modified by calling
-		/// \ref folding_registry::fixup_after_edit().
+		/// \ref folding_registry::fixup_after_edit(), and shifts all soft linebreaks. Soft linebreaks of the
+		/// modified lines will be inaccurate until they're recalculated.
 		void fixup_after_edit(buffer::end_edit_info &info, const interpretation &interp) {
+			const std::vector<interpretation::character_modification> &mods = interp.get_character_modifications();
+			for (const interpretation::character_modification &mod : mods) {
+				_lbr.on_modification(mod.position, mod.removed_chars, mod.added_chars);
+			}
 			_fr.fixup_after_edit(info, interp);
+			for (const interpretation::character_modification &mod : mods) {
+				recalc_foldreg_lines(mod.position, mod.position + mod.added_chars);
+			}
+			// visual lines are refreshed for each modification, unless the affected lines extend into the next
+			// modification, in which case they're refreshed together
+			for (std::size_t i = 0; i < mods.size(); ) {
+				std::size_t
+					beg = mods[i].position,
+					oldend = mods[i].position + mods[i].removed_chars,
+					newend = mods[i].position + mods[i].added_chars;
+				std::size_t j = i;
+				while (!_vlr.refresh(
+					_lbr, _fr, beg, oldend, newend,
+					j + 1 < mods.size() ? mods[j + 1].position : std::numeric_limits<std::size_t>::max()
+				)) {
+					++j;
+					// positions of mods[j] are after all previous modifications, and oldend should be before
+					// all modifications in the group
+					oldend = mods[j].position + mods[j].removed_chars + oldend - newend;
+					newend = mods[j].position + mods[j].added_chars;
+				}
+				i = j + 1;
+			}
 		}
 		/// Recalculates all line information of \ref _fr.
 		///
@@ -886,6 +1365,25 @@ namespace codepad::editors::code {
 			}
 			_fr._t.refresh_tree_synthesized_result();
 		}
+		/// Recalculates line information of \ref _fr after the number of visual lines in the given range of
+		/// characters has changed. Only folded regions that overlap with or are adjacent to the range are updated.
+		/// The line information of all folded regions before the range must be up-to-date.
+		void recalc_foldreg_lines(std::size_t beg, std::size_t end) {
+			folding_registry::fold_region_info info = _fr.find_region_containing_or_first_after_closed(beg);
+			std::size_t plines = info.prev_lines, totc = info.prev_chars;
+			for (auto i = info.entry; i != _fr._t.end() && totc <= end; ++i) {
+				totc += i->gap;
+				std::size_t bl = _lbr.get_visual_line_of_char(totc);
+				totc += i->range;
+				std::size_t el = _lbr.get_visual_line_of_char(totc);
+				if (i->gap_lines != bl - plines || i->folded_lines != el - bl) {
+					auto mod = _fr._t.get_modifier_for(i.get_node());
+					mod->gap_lines = bl - plines;
+					mod->folded_lines = el - bl;
+				}
+				plines = el;
+			}
+		}
 
 		/// Sets the maximum width of a `tab' character in blank spaces.
 		void set_tab_width(double v) {
@@ -900,6 +1398,10 @@ namespace codepad::editors::code {
 		const folding_registry &get_folding() const {
 			return _fr;
 		}
+		/// Returns the \ref visual_line_registry \ref _vlr.
+		const visual_line_registry &get_visual_lines() const {
+			return _vlr;
+		}
 		/// Returns the maximum width of a `tab' character, relative to the width of a blank space.
 		double get_tab_width() const {
 			return _tab;
@@ -907,6 +1409,8 @@ namespace codepad::editors::code {
 	protected:
 		soft_linebreak_registry _lbr; ///< Registry of all soft linebreaks.
 		folding_registry _fr; ///< Registry of all folded regions.
+		/// Registry of all visual lines, derived from \ref _lbr and \ref _fr.
+		visual_line_registry _vlr;
 		double _tab = 4.0f; ///< The maximum width of a `tab' character relative to the width of a blank space.
 	};
 }
@@ -9,12 +9,28 @@
 namespace codepad::os {
 	/// Linux implementation of the Cairo renderer.
 	class cairo_renderer : public ui::cairo::renderer_base {
+	public:
+		/// The surfaces of windows are kept and painted onto the window when necessary, so their contents are
+		/// preserved.
+		[[nodiscard]] bool preserves_window_contents() const override {
+			return true;
+		}
 	protected:
-		/// Calls \p gtk_widget_queue_draw() on the window.
+		/// Calls \p gtk_widget_queue_draw_area() on the damaged regions of the window, or
+		/// \p gtk_widget_queue_draw() if the entire window has been redrawn.
 		void _finish_drawing_to_target() override {
 			// TODO window flickers when resized
-			if (_render_stack.top().window) {
-				gtk_widget_queue_draw(_details::cast_window(*_render_stack.top().window).get_native_handle());
+			if (ui::window_base *wnd = _render_stack.top().window) {
+				GtkWidget *widget = _details::cast_window(*wnd).get_native_handle();
+				const std::vector<rectd> &damage = wnd->get_damage_region();
+				if (damage.empty()) {
+					gtk_widget_queue_draw(widget);
+				} else {
+					for (rectd rgn : damage) {
+						recti area = rgn.fit_grid_enlarge<int>();
+						gtk_widget_queue_draw_area(widget, area.xmin, area.ymin, area.width(), area.height());
+					}
+				}
 			}
 		}
 
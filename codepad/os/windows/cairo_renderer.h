@@ -15,6 +15,11 @@
 namespace codepad::os {
 	/// Windows implementation of the Cairo renderer.
 	class cairo_renderer : public ui::cairo::renderer_base {
+	public:
+		/// Windows are drawn to directly, and their contents are lost when they're covered.
+		[[nodiscard]] bool preserves_window_contents() const override {
+			return false;
+		}
 	protected:
 		/// Flushes the surface if the target is a window.
 		void _finish_drawing_to_target() override {
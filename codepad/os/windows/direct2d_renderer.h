@@ -287,8 +287,13 @@ namespace codepad::os::direct2d {
 			return result;
 		}
 
+	protected:
+		DWRITE_FONT_METRICS _metrics; ///< The metrics of this font.
+		_details::com_wrapper<IDWriteFont> _font; ///< The \p IDWriteFont.
+		_details::com_wrapper<IDWriteFontFace> _font_face; ///< The \p IDWriteFontFace.
+
 		/// Returns the width of the character.
-		double get_character_width_em(codepoint cp) const override {
+		double _get_character_width_em_impl(codepoint cp) const override {
 			UINT32 cp_u32 = cp;
 			UINT16 glyph;
 			DWRITE_GLYPH_METRICS gmetrics;
@@ -296,10 +301,6 @@ namespace codepad::os::direct2d {
 			_details::com_check(_font_face->GetDesignGlyphMetrics(&glyph, 1, &gmetrics, false));
 			return gmetrics.advanceWidth / static_cast<double>(_metrics.designUnitsPerEm);
 		}
-	protected:
-		DWRITE_FONT_METRICS _metrics; ///< The metrics of this font.
-		_details::com_wrapper<IDWriteFont> _font; ///< The \p IDWriteFont.
-		_details::com_wrapper<IDWriteFontFace> _font_face; ///< The \p IDWriteFontFace.
 	};
 
 	/// Encapsules a \p IDWriteFontFamily.
@@ -319,6 +320,7 @@ namespace codepad::os::direct2d {
 			));
 			_details::com_check(result->_font->CreateFontFace(result->_font_face.get_ref()));
 			result->_font_face->GetMetrics(&result->_metrics);
+			_share_character_width_table(*result, style, weight, stretch);
 			return result;
 		}
 	protected:
@@ -681,7 +683,7 @@ namespace codepad::os::direct2d {
 				resrt->_bitmap.get_ref()
 			));
 			resbmp->_bitmap = resrt->_bitmap;
-			return ui::render_target_data(std::move(resrt), std::move(resbmp));
+			return ui::render_target_data(std::move(resrt), std::move(resbmp), scaling_factor);
 		}
 
 		/// Loads a \ref bitmap from disk.
@@ -778,6 +780,11 @@ namespace codepad::os::direct2d {
 		void clear(colord color) override {
 			_d2d_device_context->Clear(_details::cast_color(color));
 		}
+		/// The contents of back buffers of flip model swap chains are undefined after presenting, so windows are
+		/// always redrawn entirely.
+		[[nodiscard]] bool preserves_window_contents() const override {
+			return false;
+		}
 
 		/// Calls \ref path_geometry_builder::_start() and returns \ref _path_builder.
 		ui::path_geometry_builder &start_path() override {
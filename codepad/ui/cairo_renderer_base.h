@@ -9,8 +9,16 @@
 #ifdef CP_USE_CAIRO
 
 #	include <stack>
+#	include <list>
+#	include <limits>
+#	include <cstdint>
+#	include <algorithm>
+#	include <string>
+#	include <vector>
+#	include <unordered_map>
 
 #	include <cairo.h>
+#	include <pango/pangocairo.h>
 
 #	include "../core/math.h"
 #	include "renderer.h"
@@ -18,6 +26,7 @@
 
 namespace codepad::ui::cairo {
 	class renderer_base;
+	class font_family;
 
 	namespace _details {
 		/// Converts a \ref matd3x3 to a \p cairo_matrix_t.
@@ -45,6 +54,8 @@ namespace codepad::ui::cairo {
 					cairo_surface_reference(this->_handle);
 				} else if constexpr (std::is_same_v<T, cairo_pattern_t>) {
 					cairo_pattern_reference(this->_handle);
+				} else if constexpr (std::is_same_v<T, cairo_scaled_font_t>) {
+					cairo_scaled_font_reference(this->_handle);
 				} else if constexpr (std::is_same_v<T, PangoAttrList>) {
 					pango_attr_list_ref(this->_handle);
 				} else {
@@ -61,6 +72,8 @@ namespace codepad::ui::cairo {
 					cairo_surface_destroy(this->_handle);
 				} else if constexpr (std::is_same_v<T, cairo_pattern_t>) {
 					cairo_pattern_destroy(this->_handle);
+				} else if constexpr (std::is_same_v<T, cairo_scaled_font_t>) {
+					cairo_scaled_font_destroy(this->_handle);
 				} else if constexpr (std::is_same_v<T, PangoAttrList>) {
 					pango_attr_list_unref(this->_handle);
 				} else {
@@ -153,6 +166,18 @@ namespace codepad::ui::cairo {
 			// TODO
 			return PANGO_STRETCH_NORMAL;
 		}
+
+		/// Shapes the given UTF-8 text as a single left-to-right run using only the given font, and stores the
+		/// result in \p glyphs. No font fallback or bidirectional reordering is performed.
+		inline void shape_run(PangoFont *font, const std::string &text, PangoGlyphString *glyphs) {
+			PangoAnalysis analysis{};
+			analysis.font = font;
+			analysis.level = 0;
+			analysis.gravity = PANGO_GRAVITY_SOUTH;
+			analysis.script = PANGO_SCRIPT_LATIN; // TODO same as the Direct2D renderer, always use latin script
+			analysis.language = pango_language_get_default();
+			pango_shape(text.c_str(), static_cast<int>(text.size()), &analysis, glyphs);
+		}
 	}
 
 	/// A Cairo surface used as a source.
@@ -253,57 +278,571 @@ namespace codepad::ui::cairo {
 		_details::glib_object_ref<PangoLayout> _layout; ///< The underlying \p PangoLayout object.
 	};
 
-	///
+	/// A font in a font family. Pango fonts are loaded on demand for each size that's used to create
+	/// \ref plain_text objects.
 	class font : public ui::font {
 		friend renderer_base;
 		friend font_family;
 	public:
-		///
+		/// The size of the font that's used to compute metrics in em units.
+		constexpr static double reference_font_size = 64.0;
+
+		/// Returns \ref _ascent_em.
 		[[nodiscard]] double get_ascent_em() const override {
-			// TODO
-			return 0.0;
+			return _ascent_em;
 		}
-		///
+		/// Returns \ref _line_height_em.
 		[[nodiscard]] double get_line_height_em() const override {
-			// TODO
-			return 0.0;
+			return _line_height_em;
 		}
 
-		///
-		[[nodiscard]] double get_character_width_em(codepoint) const override {
-			// TODO
-			return 0.0;
+		/// Checks the coverage of the font at the reference size.
+		[[nodiscard]] bool has_character(codepoint cp) const override {
+			PangoCoverage *coverage = pango_font_get_coverage(
+				_get_font_at_size(reference_font_size), pango_language_get_default()
+			);
+			bool result = pango_coverage_get(coverage, static_cast<int>(cp)) != PANGO_COVERAGE_NONE;
+			pango_coverage_unref(coverage);
+			return result;
+		}
+	protected:
+		/// Fonts of this face at all sizes that have been used, indexed by their sizes in pixels.
+		mutable std::unordered_map<double, _details::glib_object_ref<PangoFont>> _sized_fonts;
+		_details::glib_object_ref<PangoContext> _context; ///< The context used to load fonts.
+		std::string _family; ///< The name of the font family.
+		font_style _style = font_style::normal; ///< The style of this font.
+		font_weight _weight = font_weight::normal; ///< The weight of this font.
+		font_stretch _stretch = font_stretch::normal; ///< The stretch of this font.
+		double
+			_ascent_em = 0.0, ///< The ascent of this font in em units.
+			_line_height_em = 0.0; ///< The line height of this font in em units.
+
+		/// Returns the \p PangoFont of this font face with the given size in pixels, loading it if necessary.
+		[[nodiscard]] PangoFont *_get_font_at_size(double size) const {
+			auto it = _sized_fonts.find(size);
+			if (it == _sized_fonts.end()) {
+				PangoFontDescription *desc = pango_font_description_new();
+				pango_font_description_set_family(desc, _family.c_str());
+				pango_font_description_set_style(desc, _details::cast_font_style(_style));
+				pango_font_description_set_weight(desc, _details::cast_font_weight(_weight));
+				pango_font_description_set_stretch(desc, _details::cast_font_stretch(_stretch));
+				pango_font_description_set_absolute_size(desc, size * PANGO_SCALE);
+				PangoFont *loaded = pango_context_load_font(_context.get(), desc);
+				pango_font_description_free(desc);
+				assert_true_sys(loaded != nullptr, "failed to load font");
+				it = _sized_fonts.emplace(size, _details::make_glib_object_ref_give(loaded)).first;
+			}
+			return it->second.get();
+		}
+		/// Computes \ref _ascent_em and \ref _line_height_em using the font at the reference size.
+		void _compute_metrics() {
+			PangoFontMetrics *metrics = pango_font_get_metrics(_get_font_at_size(reference_font_size), nullptr);
+			double
+				ascent = pango_units_to_double(pango_font_metrics_get_ascent(metrics)),
+				descent = pango_units_to_double(pango_font_metrics_get_descent(metrics));
+			pango_font_metrics_unref(metrics);
+			_ascent_em = ascent / reference_font_size;
+			_line_height_em = (ascent + descent) / reference_font_size;
+		}
+
+		/// Shapes the character using the font at the reference size and returns its width.
+		[[nodiscard]] double _get_character_width_em_impl(codepoint cp) const override {
+			auto utf8 = encodings::utf8::encode_codepoint(cp);
+			PangoGlyphString *glyphs = pango_glyph_string_new();
+			_details::shape_run(
+				_get_font_at_size(reference_font_size),
+				std::string(reinterpret_cast<const char*>(utf8.c_str()), utf8.size()), glyphs
+			);
+			double width = pango_units_to_double(pango_glyph_string_get_width(glyphs));
+			pango_glyph_string_free(glyphs);
+			return width / reference_font_size;
 		}
 	};
 
-	///
+	/// A font family, identified by its name.
 	class font_family : public ui::font_family {
 		friend renderer_base;
 	public:
 		/// Returns a font in this family matching the given description.
 		[[nodiscard]] std::unique_ptr<ui::font> get_matching_font(
-			font_style, font_weight, font_stretch
+			font_style style, font_weight weight, font_stretch stretch
 		) const override {
-			return std::make_unique<font>();
+			auto result = std::make_unique<font>();
+			result->_context = _context;
+			result->_family = _family;
+			result->_style = style;
+			result->_weight = weight;
+			result->_stretch = stretch;
+			result->_compute_metrics();
+			_share_character_width_table(*result, style, weight, stretch);
+			return result;
 		}
+	protected:
+		_details::glib_object_ref<PangoContext> _context; ///< The context used to load fonts.
+		std::string _family; ///< The name of this font family.
 	};
 
-	///
+	/// A piece of text that has been shaped using a single sized font. Objects of this type are immutable once
+	/// created, and are cached by \ref renderer_base and shared among all \ref plain_text objects with the same
+	/// font, size, and contents.
+	struct glyph_run {
+		_details::glib_object_ref<PangoFont> font; ///< The font used to shape the text, at the correct size.
+		/// The glyphs that are actually drawn. Glyphs are positioned relative to the top left corner of the text,
+		/// with the baseline at \ref ascent. Empty and unknown glyphs are not included.
+		std::vector<cairo_glyph_t> glyphs;
+		/// The horizontal positions of the left borders of all clusters. A cluster is a group of glyphs that
+		/// correspond to a group of characters. This array has one additional element at the back that is the
+		/// total width of the text.
+		std::vector<double> cluster_positions;
+		/// The index of the first character of each cluster. This array has one additional element at the back
+		/// that is the total number of characters.
+		std::vector<std::size_t> cluster_characters;
+		std::vector<std::size_t> character_clusters; ///< The index of the cluster that each character belongs to.
+		double
+			ascent = 0.0, ///< The distance from the top of the text to the baseline.
+			height = 0.0; ///< The height of a line of text.
+
+		/// Returns the placement of the given character.
+		[[nodiscard]] rectd get_character_placement(std::size_t pos) const {
+			if (pos >= character_clusters.size()) {
+				return rectd::from_xywh(cluster_positions.back(), 0.0, 0.0, height);
+			}
+			std::size_t cluster = character_clusters[pos];
+			double width =
+				(cluster_positions[cluster + 1] - cluster_positions[cluster]) /
+				static_cast<double>(cluster_characters[cluster + 1] - cluster_characters[cluster]);
+			return rectd::from_xywh(
+				cluster_positions[cluster] + width * static_cast<double>(pos - cluster_characters[cluster]),
+				0.0, width, height
+			);
+		}
+	};
+
+	/// A single line of text with the same font parameters, backed by a shared \ref glyph_run.
 	class plain_text : public ui::plain_text {
 		friend renderer_base;
 	public:
 		/// Returns the total width of this text clip.
 		[[nodiscard]] double get_width() const override {
-			return 0.0;
+			return _run->cluster_positions.back();
 		}
 
-		/// Retrieves information about the character that is below the given horizontal position.
-		[[nodiscard]] caret_hit_test_result hit_test(double) const override {
-			return caret_hit_test_result();
+		/// Finds the cluster using binary search, then the character inside the cluster assuming that all
+		/// characters in the cluster have the same width.
+		[[nodiscard]] caret_hit_test_result hit_test(double xpos) const override {
+			const auto &positions = _run->cluster_positions;
+			auto it = std::upper_bound(positions.begin(), positions.end(), xpos);
+			if (it != positions.begin()) {
+				--it;
+			}
+			auto cluster = static_cast<std::size_t>(it - positions.begin());
+
+			caret_hit_test_result result;
+			if (cluster + 1 < positions.size()) {
+				std::size_t
+					firstchar = _run->cluster_characters[cluster],
+					nchars = _run->cluster_characters[cluster + 1] - firstchar;
+				double width = positions[cluster + 1] - positions[cluster], ratio = 0.0;
+				if (width > 0.0) {
+					ratio = std::max(0.0, (xpos - positions[cluster]) / width) * static_cast<double>(nchars);
+				}
+				std::size_t offset = std::min(static_cast<std::size_t>(ratio), nchars - 1);
+				result.character = firstchar + offset;
+				result.rear = ratio - static_cast<double>(offset) > 0.5;
+			} else { // past the end
+				result.character = _run->character_clusters.size();
+				result.rear = false;
+			}
+			result.character_layout = _run->get_character_placement(result.character);
+			return result;
 		}
 		/// Returns the space occupied by the character at the given position.
-		[[nodiscard]] rectd get_character_placement(std::size_t) const override {
-			return rectd();
+		[[nodiscard]] rectd get_character_placement(std::size_t pos) const override {
+			return _run->get_character_placement(pos);
+		}
+	protected:
+		std::shared_ptr<const glyph_run> _run; ///< The shaped text.
+	};
+
+	/// Caches rasterized glyphs as coverage masks in atlases of A8 image surfaces, so that each glyph is only
+	/// rasterized once for each font, size, device scale, and horizontal subpixel offset. Atlases are evicted in
+	/// least-recently-used order when the total memory used by all atlases exceeds the budget.
+	class glyph_cache {
+	public:
+		constexpr static int page_size = 512; ///< The width and height of a page in an atlas, in pixels.
+		/// The number of horizontal subpixel positions that glyphs are rasterized at.
+		constexpr static int subpixel_positions = 4;
+		/// The default maximum number of bytes used by all atlases.
+		constexpr static std::size_t default_memory_budget = 32 * 1024 * 1024;
+
+		/// Statistics about the memory usage and the efficiency of the cache.
+		struct statistics {
+			std::size_t
+				atlases = 0, ///< The number of atlases.
+				pages = 0, ///< The total number of pages in all atlases.
+				glyphs = 0, ///< The total number of rasterized glyphs.
+				bytes = 0, ///< The total number of bytes used by all pages.
+				hits = 0, ///< The number of glyphs that have been drawn using a cached mask.
+				misses = 0, ///< The number of glyphs that have been rasterized.
+				evictions = 0; ///< The number of atlases that have been evicted.
+		};
+
+		/// Draws the given glyphs, composing their cached masks into a single mask for the whole run and painting
+		/// it onto the target with one mask operation. Only transformations that are pure translations are
+		/// supported; for other transformations this function draws nothing and returns \p false.
+		///
+		/// \param context The target context.
+		/// \param font The font used to shape the glyphs, at the correct size.
+		/// \param glyphs The glyphs, relative to \p pos.
+		/// \param pos The position of the glyphs.
+		/// \param transform The current transformation of \p context.
+		/// \param color The color of the text.
+		bool draw(
+			cairo_t *context, PangoFont *font, const std::vector<cairo_glyph_t> &glyphs,
+			vec2d pos, const matd3x3 &transform, colord color
+		) {
+			if (
+				transform[0][0] != 1.0 || transform[0][1] != 0.0 ||
+				transform[1][0] != 0.0 || transform[1][1] != 1.0
+			) {
+				return false;
+			}
+			vec2d scale;
+			cairo_surface_get_device_scale(cairo_get_target(context), &scale.x, &scale.y);
+			_atlas &atlas = _get_atlas(font, scale);
+			vec2d origin(
+				(pos.x + transform[0][2]) * scale.x,
+				(pos.y + transform[1][2]) * scale.y
+			);
+
+			// find or rasterize all glyphs, and compute the bounding box of the run
+			_placements.clear();
+			int xmin = std::numeric_limits<int>::max(), ymin = xmin;
+			int xmax = std::numeric_limits<int>::min(), ymax = xmax;
+			for (const cairo_glyph_t &glyph : glyphs) {
+				double x = origin.x + glyph.x * scale.x;
+				auto px = static_cast<int>(std::floor(x));
+				auto subpixel = static_cast<int>(std::round((x - px) * subpixel_positions));
+				if (subpixel == subpixel_positions) {
+					++px;
+					subpixel = 0;
+				}
+				auto py = static_cast<int>(std::round(origin.y + glyph.y * scale.y));
+
+				const _glyph_entry *entry = _get_glyph(atlas, glyph.index, subpixel);
+				if (entry == nullptr) { // the glyph is too large to be cached
+					return false;
+				}
+				if (entry->width > 0) {
+					_glyph_placement &placement = _placements.emplace_back();
+					placement.entry = entry;
+					placement.x = px + entry->offset_x;
+					placement.y = py + entry->offset_y;
+					xmin = std::min(xmin, placement.x);
+					ymin = std::min(ymin, placement.y);
+					xmax = std::max(xmax, placement.x + entry->width);
+					ymax = std::max(ymax, placement.y + entry->height);
+				}
+			}
+			if (_placements.empty()) {
+				return true;
+			}
+
+			// compose the mask of the run
+			int width = xmax - xmin, height = ymax - ymin;
+			cairo_t *scratch = _get_scratch(width, height);
+			cairo_set_operator(scratch, CAIRO_OPERATOR_CLEAR);
+			cairo_rectangle(scratch, 0.0, 0.0, width, height);
+			cairo_fill(scratch);
+			cairo_set_operator(scratch, CAIRO_OPERATOR_ADD);
+			for (const _glyph_placement &placement : _placements) {
+				const _glyph_entry &entry = *placement.entry;
+				int x = placement.x - xmin, y = placement.y - ymin;
+				cairo_set_source_surface(
+					scratch, atlas.pages[entry.page].surface.get(), x - entry.x, y - entry.y
+				);
+				cairo_rectangle(scratch, x, y, entry.width, entry.height);
+				cairo_fill(scratch);
+			}
+			cairo_set_source_rgb(scratch, 0.0, 0.0, 0.0); // release the page
+
+			// paint the run in device pixels
+			cairo_save(context);
+			{
+				cairo_matrix_t device;
+				cairo_matrix_init_scale(&device, 1.0 / scale.x, 1.0 / scale.y);
+				cairo_set_matrix(context, &device);
+				cairo_rectangle(context, xmin, ymin, width, height);
+				cairo_clip(context);
+				cairo_set_source_rgba(context, color.r, color.g, color.b, color.a);
+				cairo_mask_surface(context, _scratch.get(), xmin, ymin);
+			}
+			cairo_restore(context);
+			return true;
+		}
+
+		/// Removes all cached glyphs.
+		void clear() {
+			_stats.evictions += _atlases.size();
+			_atlases.clear();
+			_atlas_index.clear();
+			_stats.atlases = _stats.pages = _stats.glyphs = _stats.bytes = 0;
+		}
+
+		/// Sets the memory budget. Atlases are only evicted the next time a page is allocated.
+		void set_memory_budget(std::size_t bytes) {
+			_memory_budget = bytes;
+		}
+		/// Returns \ref _memory_budget.
+		[[nodiscard]] std::size_t get_memory_budget() const {
+			return _memory_budget;
+		}
+		/// Returns \ref _stats.
+		[[nodiscard]] const statistics &get_statistics() const {
+			return _stats;
+		}
+	protected:
+		/// The location of a rasterized glyph in an atlas.
+		struct _glyph_entry {
+			std::size_t page = 0; ///< The index of the page.
+			int
+				x = 0, ///< The horizontal position of the mask in the page.
+				y = 0, ///< The vertical position of the mask in the page.
+				width = 0, ///< The width of the mask. Zero for glyphs without any visible pixels.
+				height = 0, ///< The height of the mask.
+				offset_x = 0, ///< The horizontal offset of the mask from the pen position.
+				offset_y = 0; ///< The vertical offset of the mask from the pen position.
+		};
+		/// A row of glyphs in a page.
+		struct _shelf {
+			int
+				y = 0, ///< The vertical position of this shelf.
+				height = 0, ///< The height of this shelf.
+				used_width = 0; ///< The total width of all glyphs in this shelf.
+		};
+		/// A page in an atlas.
+		struct _page {
+			_details::gtk_object_ref<cairo_surface_t> surface; ///< The A8 surface.
+			_details::gtk_object_ref<cairo_t> context; ///< The context used to rasterize glyphs.
+			std::vector<_shelf> shelves; ///< All shelves in this page.
+			int used_height = 0; ///< The total height of all shelves.
+		};
+		/// Identifies an atlas.
+		struct _atlas_key {
+			PangoFont *font = nullptr; ///< The font, at the correct size.
+			vec2d scale; ///< The device scale.
+
+			/// Equality.
+			friend bool operator==(const _atlas_key &lhs, const _atlas_key &rhs) {
+				return lhs.font == rhs.font && lhs.scale.x == rhs.scale.x && lhs.scale.y == rhs.scale.y;
+			}
+		};
+		/// Hash function of \ref _atlas_key.
+		struct _atlas_key_hash {
+			/// Combines the hash values of all fields.
+			std::size_t operator()(const _atlas_key &key) const {
+				std::size_t
+					font_hash = std::hash<PangoFont*>()(key.font),
+					scale_hash = std::hash<double>()(key.scale.x) ^ (std::hash<double>()(key.scale.y) << 1);
+				return font_hash ^ (scale_hash + 0x9e3779b9 + (font_hash << 6) + (font_hash >> 2));
+			}
+		};
+		/// Rasterized glyphs of a font at a specific size and device scale.
+		struct _atlas {
+			_atlas_key key; ///< The key of this atlas.
+			_details::glib_object_ref<PangoFont> font; ///< Keeps \ref _atlas_key::font alive.
+			/// The font used to rasterize glyphs, scaled to device pixels.
+			_details::gtk_object_ref<cairo_scaled_font_t> scaled_font;
+			std::vector<_page> pages; ///< The pages of this atlas.
+			/// All rasterized glyphs, indexed by the glyph index and the subpixel position.
+			std::unordered_map<std::uint64_t, _glyph_entry> glyphs;
+		};
+		/// A glyph in the run that's being drawn.
+		struct _glyph_placement {
+			const _glyph_entry *entry = nullptr; ///< The cached glyph.
+			int
+				x = 0, ///< The horizontal position of the mask in device pixels.
+				y = 0; ///< The vertical position of the mask in device pixels.
+		};
+
+		std::list<_atlas> _atlases; ///< All atlases, with the most recently used one at the front.
+		/// Indices of all elements in \ref _atlases.
+		std::unordered_map<_atlas_key, std::list<_atlas>::iterator, _atlas_key_hash> _atlas_index;
+		std::vector<_glyph_placement> _placements; ///< Reused when drawing runs.
+		_details::gtk_object_ref<cairo_surface_t> _scratch; ///< The A8 surface used to compose masks of runs.
+		_details::gtk_object_ref<cairo_t> _scratch_context; ///< The context of \ref _scratch.
+		statistics _stats; ///< Statistics of this cache.
+		std::size_t _memory_budget = default_memory_budget; ///< The maximum number of bytes used by all pages.
+
+		/// Returns the atlas with the given font and scale, creating it if necessary, and marks it as the most
+		/// recently used one.
+		_atlas &_get_atlas(PangoFont *font, vec2d scale) {
+			_atlas_key key;
+			key.font = font;
+			key.scale = scale;
+			if (auto it = _atlas_index.find(key); it != _atlas_index.end()) {
+				_atlases.splice(_atlases.begin(), _atlases, it->second);
+				return _atlases.front();
+			}
+
+			_atlas &atlas = _atlases.emplace_front();
+			atlas.key = key;
+			atlas.font = _details::make_glib_object_ref_share(font);
+			{ // create a scaled font that maps directly to device pixels
+				cairo_scaled_font_t *base = pango_cairo_font_get_scaled_font(PANGO_CAIRO_FONT(font));
+				cairo_matrix_t font_matrix, scale_matrix, device_matrix, identity;
+				cairo_scaled_font_get_font_matrix(base, &font_matrix);
+				cairo_matrix_init_scale(&scale_matrix, scale.x, scale.y);
+				cairo_matrix_multiply(&device_matrix, &font_matrix, &scale_matrix);
+				cairo_matrix_init_identity(&identity);
+				cairo_font_options_t *options = cairo_font_options_create();
+				cairo_scaled_font_get_font_options(base, options);
+				atlas.scaled_font = _details::make_gtk_object_ref_give(cairo_scaled_font_create(
+					cairo_scaled_font_get_font_face(base), &device_matrix, &identity, options
+				));
+				cairo_font_options_destroy(options);
+			}
+			_atlas_index.emplace(key, _atlases.begin());
+			++_stats.atlases;
+			return atlas;
+		}
+		/// Returns the entry of the given glyph, rasterizing it if necessary. Returns \p nullptr if the glyph is
+		/// too large to fit in a page.
+		const _glyph_entry *_get_glyph(_atlas &atlas, unsigned long index, int subpixel) {
+			std::uint64_t id = (static_cast<std::uint64_t>(index) << 8) | static_cast<std::uint64_t>(subpixel);
+			if (auto it = atlas.glyphs.find(id); it != atlas.glyphs.end()) {
+				++_stats.hits;
+				return &it->second;
+			}
+			++_stats.misses;
+
+			double subpixel_offset = subpixel / static_cast<double>(subpixel_positions);
+			cairo_glyph_t glyph;
+			glyph.index = index;
+			glyph.x = glyph.y = 0.0;
+			cairo_text_extents_t extents;
+			cairo_scaled_font_glyph_extents(atlas.scaled_font.get(), &glyph, 1, &extents);
+
+			_glyph_entry entry;
+			if (extents.width > 0.0 && extents.height > 0.0) {
+				// leave a one-pixel border around the glyph for antialiasing
+				int
+					left = static_cast<int>(std::floor(extents.x_bearing + subpixel_offset)) - 1,
+					top = static_cast<int>(std::floor(extents.y_bearing)) - 1,
+					right = static_cast<int>(std::ceil(extents.x_bearing + extents.width + subpixel_offset)) + 1,
+					bottom = static_cast<int>(std::ceil(extents.y_bearing + extents.height)) + 1;
+				entry.width = right - left;
+				entry.height = bottom - top;
+				entry.offset_x = left;
+				entry.offset_y = top;
+				if (!_allocate(atlas, entry)) {
+					return nullptr;
+				}
+
+				cairo_t *context = atlas.pages[entry.page].context.get();
+				cairo_save(context);
+				cairo_rectangle(context, entry.x, entry.y, entry.width, entry.height);
+				cairo_clip(context);
+				cairo_set_scaled_font(context, atlas.scaled_font.get());
+				glyph.x = entry.x - left + subpixel_offset;
+				glyph.y = entry.y - top;
+				cairo_show_glyphs(context, &glyph, 1);
+				cairo_restore(context);
+			}
+			++_stats.glyphs;
+			return &atlas.glyphs.emplace(id, entry).first->second;
+		}
+		/// Finds space for the glyph in the given atlas using shelf packing, adding a new page if necessary.
+		/// Returns \p false if the glyph is too large.
+		bool _allocate(_atlas &atlas, _glyph_entry &entry) {
+			if (entry.width > page_size || entry.height > page_size) {
+				return false;
+			}
+			if (!atlas.pages.empty()) { // only the last page can have free space
+				_page &page = atlas.pages.back();
+				for (_shelf &shelf : page.shelves) {
+					if (
+						shelf.height >= entry.height && shelf.height <= entry.height * 2 &&
+						shelf.used_width + entry.width <= page_size
+					) {
+						entry.page = atlas.pages.size() - 1;
+						entry.x = shelf.used_width;
+						entry.y = shelf.y;
+						shelf.used_width += entry.width;
+						return true;
+					}
+				}
+				if (page.used_height + entry.height <= page_size) {
+					_shelf &shelf = page.shelves.emplace_back();
+					shelf.y = page.used_height;
+					shelf.height = entry.height;
+					shelf.used_width = entry.width;
+					page.used_height += entry.height;
+					entry.page = atlas.pages.size() - 1;
+					entry.x = 0;
+					entry.y = shelf.y;
+					return true;
+				}
+			}
+
+			// evict least recently used atlases to make room for the new page
+			std::size_t page_bytes = _get_page_bytes();
+			while (_stats.bytes + page_bytes > _memory_budget && &_atlases.back() != &atlas) {
+				_evict_least_recently_used();
+			}
+
+			_page &page = atlas.pages.emplace_back();
+			page.surface = _details::make_gtk_object_ref_give(
+				cairo_image_surface_create(CAIRO_FORMAT_A8, page_size, page_size)
+			);
+			assert_true_sys(
+				cairo_surface_status(page.surface.get()) == CAIRO_STATUS_SUCCESS,
+				"failed to create glyph atlas page"
+			);
+			page.context = _details::make_gtk_object_ref_give(cairo_create(page.surface.get()));
+			_shelf &shelf = page.shelves.emplace_back();
+			shelf.height = page.used_height = entry.height;
+			shelf.used_width = entry.width;
+			entry.page = atlas.pages.size() - 1;
+			entry.x = entry.y = 0;
+
+			++_stats.pages;
+			_stats.bytes += page_bytes;
+			return true;
+		}
+		/// Removes the least recently used atlas.
+		void _evict_least_recently_used() {
+			_atlas &atlas = _atlases.back();
+			_stats.pages -= atlas.pages.size();
+			_stats.glyphs -= atlas.glyphs.size();
+			_stats.bytes -= atlas.pages.size() * _get_page_bytes();
+			--_stats.atlases;
+			++_stats.evictions;
+			_atlas_index.erase(atlas.key);
+			_atlases.pop_back();
+		}
+		/// Returns the number of bytes used by a single page.
+		[[nodiscard]] inline static std::size_t _get_page_bytes() {
+			return static_cast<std::size_t>(cairo_format_stride_for_width(CAIRO_FORMAT_A8, page_size)) * page_size;
+		}
+		/// Returns the context of \ref _scratch, enlarging it if it's smaller than the given size.
+		cairo_t *_get_scratch(int width, int height) {
+			if (
+				!_scratch ||
+				cairo_image_surface_get_width(_scratch.get()) < width ||
+				cairo_image_surface_get_height(_scratch.get()) < height
+			) {
+				if (_scratch) {
+					width = std::max(width, cairo_image_surface_get_width(_scratch.get()));
+					height = std::max(height, cairo_image_surface_get_height(_scratch.get()));
+				}
+				_scratch_context.reset();
+				_scratch = _details::make_gtk_object_ref_give(
+					cairo_image_surface_create(CAIRO_FORMAT_A8, width, height)
+				);
+				_scratch_context = _details::make_gtk_object_ref_give(cairo_create(_scratch.get()));
+			}
+			return _scratch_context.get();
 		}
 	};
 
@@ -391,6 +930,18 @@ namespace codepad::ui::cairo {
 			assert_true_usage(rt, "invalid formatted text type");
 			return *rt;
 		}
+		/// Casts a \ref ui::font to a \ref font.
+		inline font &cast_font(ui::font &f) {
+			auto *rf = dynamic_cast<font*>(&f);
+			assert_true_usage(rf, "invalid font type");
+			return *rf;
+		}
+		/// Casts a \ref ui::plain_text to a \ref plain_text.
+		inline plain_text &cast_plain_text(ui::plain_text &t) {
+			auto *rt = dynamic_cast<plain_text*>(&t);
+			assert_true_usage(rt, "invalid plain text type");
+			return *rt;
+		}
 	}
 
 	/// Platform-independent base class for Cairo renderers.
@@ -403,8 +954,14 @@ namespace codepad::ui::cairo {
 		renderer_base() {
 			_pango_context.set_give(pango_font_map_create_context(pango_cairo_font_map_get_default()));
 		}
-		/// Calls \p cairo_debug_reset_static_data() to clean up.
+		/// Releases all cached fonts, glyphs, and surfaces, then calls \p cairo_debug_reset_static_data() to clean
+		/// up.
 		~renderer_base() {
+			_font_families.clear();
+			_shaping_cache_current.clear();
+			_shaping_cache_previous.clear();
+			_glyph_cache.clear();
+			_render_target_pool.clear();
 			cairo_debug_reset_static_data();
 		}
 
@@ -435,7 +992,7 @@ namespace codepad::ui::cairo {
 				"failed to create cairo context"
 			);
 
-			return render_target_data(std::move(resrt), std::move(resbmp));
+			return render_target_data(std::move(resrt), std::move(resbmp), scaling_factor);
 		}
 
 		/// Loads a \ref bitmap from disk as an image surface.
@@ -447,10 +1004,12 @@ namespace codepad::ui::cairo {
 			return res;
 		}
 
-		/// Creates a new \ref text_format.
+		/// Creates a new \ref font_family. Fonts are only loaded when they're used.
 		std::unique_ptr<ui::font_family> find_font_family(str_view_t family) override {
-			// TODO
-			return std::make_unique<font_family>();
+			auto result = std::make_unique<font_family>();
+			result->_context = _pango_context;
+			result->_family = std::string(family);
+			return result;
 		}
 
 		/// Starts drawing to the given window.
@@ -471,13 +1030,13 @@ namespace codepad::ui::cairo {
 			_render_stack.pop();
 		}
 
-		/// Clears the current surface.
+		/// Clears the current surface. The clip is respected so that partially redrawn windows are not cleared
+		/// entirely.
 		void clear(colord color) override {
 			cairo_t *context = _render_stack.top().context;
 			cairo_save(context);
 			{
 				// reset state
-				cairo_reset_clip(context);
 				cairo_set_operator(context, CAIRO_OPERATOR_SOURCE);
 				// clear
 				cairo_set_source_rgba(context, color.r, color.g, color.b, color.a);
@@ -624,21 +1183,50 @@ namespace codepad::ui::cairo {
 			cairo_new_path(context);
 		}
 
-		///
-		std::unique_ptr<ui::plain_text> create_plain_text(str_view_t, ui::font&, double) override {
-			// TODO
-			return std::make_unique<plain_text>();
+		/// Decodes the text and calls \ref _create_plain_text_impl() to shape it.
+		std::unique_ptr<ui::plain_text> create_plain_text(str_view_t text, ui::font &f, double size) override {
+			std::basic_string<codepoint> utf32;
+			for (auto it = text.begin(); it != text.end(); ) {
+				codepoint cp;
+				if (!encodings::utf8::next_codepoint(it, text.end(), cp)) {
+					cp = encodings::replacement_character;
+				}
+				utf32.push_back(cp);
+			}
+			return _create_plain_text_impl(utf32, f, size);
 		}
-		///
+		/// Calls \ref _create_plain_text_impl() to shape the given text.
 		std::unique_ptr<ui::plain_text> create_plain_text(
-			std::basic_string_view<codepoint>, ui::font&, double
+			std::basic_string_view<codepoint> text, ui::font &f, double size
 		) override {
-			// TODO
-			return std::make_unique<plain_text>();
+			return _create_plain_text_impl(text, f, size);
 		}
-		///
-		void draw_plain_text(ui::plain_text&, vec2d, colord) override {
-			// TODO
+		/// Draws the glyphs using \ref _glyph_cache if possible, and falls back to \p cairo_show_glyphs() for
+		/// transformations that the cache does not support. The position indicates the top left corner of the text.
+		void draw_plain_text(ui::plain_text &t, vec2d pos, colord color) override {
+			const glyph_run &run = *_details::cast_plain_text(t)._run;
+			if (run.glyphs.empty()) {
+				return;
+			}
+			_render_target_stackframe &stackframe = _render_stack.top();
+			cairo_t *context = stackframe.context;
+			if (_glyph_cache.draw(context, run.font.get(), run.glyphs, pos, stackframe.matrices.top(), color)) {
+				return;
+			}
+
+			cairo_set_scaled_font(context, pango_cairo_font_get_scaled_font(PANGO_CAIRO_FONT(run.font.get())));
+			cairo_set_source_rgba(context, color.r, color.g, color.b, color.a);
+			cairo_translate(context, pos.x, pos.y);
+			cairo_show_glyphs(context, run.glyphs.data(), static_cast<int>(run.glyphs.size()));
+
+			stackframe.update_transform(); // restore transform
+			// release the source pattern
+			cairo_set_source_rgb(context, 1.0, 0.4, 0.7);
+		}
+
+		/// Returns the \ref glyph_cache used to draw \ref plain_text objects.
+		[[nodiscard]] glyph_cache &get_glyph_cache() {
+			return _glyph_cache;
 		}
 	protected:
 		/// Holds the \p cairo_t associated with a window.
@@ -683,6 +1271,30 @@ namespace codepad::ui::cairo {
 		path_geometry_builder _path_builder; ///< The \ref path_geometry_builder.
 		_details::glib_object_ref<PangoContext> _pango_context; ///< The Pango context.
 
+		/// Key of the shaping cache: the font at a specific size, and the text encoded in UTF-8.
+		using _shaping_key = std::pair<PangoFont*, std::string>;
+		/// Hash function of \ref _shaping_key.
+		struct _shaping_key_hash {
+			/// Combines the hash values of the font pointer and the text.
+			std::size_t operator()(const _shaping_key &key) const {
+				std::size_t
+					font_hash = std::hash<PangoFont*>()(key.first),
+					text_hash = std::hash<std::string>()(key.second);
+				return text_hash ^ (font_hash + 0x9e3779b9 + (text_hash << 6) + (text_hash >> 2));
+			}
+		};
+		/// A generation of cached shaping results.
+		using _shaping_cache = std::unordered_map<_shaping_key, std::shared_ptr<const glyph_run>, _shaping_key_hash>;
+		/// The maximum number of entries in a generation of the shaping cache. When \ref _shaping_cache_current
+		/// becomes full, it replaces \ref _shaping_cache_previous, so that runs that have not been used since are
+		/// dropped.
+		constexpr static std::size_t _shaping_cache_generation_size = 4096;
+
+		_shaping_cache
+			_shaping_cache_current, ///< Shaping results that have been used recently.
+			_shaping_cache_previous; ///< Shaping results from the last generation.
+		glyph_cache _glyph_cache; ///< Rasterized glyphs used to draw \ref plain_text objects.
+
 
 		/// Draws the current path using the given brush and pen.
 		inline static void _draw_path(
@@ -887,6 +1499,97 @@ namespace codepad::ui::cairo {
 		}
 
 
+		/// Returns the \ref glyph_run of the given text, either from the shaping cache or by shaping it. Each
+		/// cluster produced by Pango is mapped back to the range of characters it covers.
+		std::shared_ptr<const glyph_run> _get_glyph_run(std::basic_string_view<codepoint> text, PangoFont *pfont) {
+			// encode the text, recording the character that each byte belongs to
+			std::string utf8;
+			std::vector<std::size_t> byte_chars;
+			for (std::size_t i = 0; i < text.size(); ++i) {
+				codepoint cp = text[i];
+				if (!encodings::is_valid_codepoint(cp)) {
+					cp = encodings::replacement_character;
+				}
+				auto bytes = encodings::utf8::encode_codepoint(cp);
+				utf8.append(reinterpret_cast<const char*>(bytes.c_str()), bytes.size());
+				byte_chars.insert(byte_chars.end(), bytes.size(), i);
+			}
+
+			// look up the cache
+			_shaping_key key(pfont, std::move(utf8));
+			if (auto it = _shaping_cache_current.find(key); it != _shaping_cache_current.end()) {
+				return it->second;
+			}
+			if (auto it = _shaping_cache_previous.find(key); it != _shaping_cache_previous.end()) {
+				auto run = it->second;
+				_shaping_cache_previous.erase(it);
+				_cache_glyph_run(std::move(key), run);
+				return run;
+			}
+
+			auto run = std::make_shared<glyph_run>();
+			run->font = _details::make_glib_object_ref_share(pfont);
+			{ // metrics
+				PangoFontMetrics *metrics = pango_font_get_metrics(pfont, nullptr);
+				run->ascent = pango_units_to_double(pango_font_metrics_get_ascent(metrics));
+				run->height = run->ascent + pango_units_to_double(pango_font_metrics_get_descent(metrics));
+				pango_font_metrics_unref(metrics);
+			}
+
+			PangoGlyphString *glyphs = pango_glyph_string_new();
+			_details::shape_run(pfont, key.second, glyphs);
+			double x = 0.0;
+			for (int i = 0; i < glyphs->num_glyphs; ++i) {
+				const PangoGlyphInfo &info = glyphs->glyphs[i];
+				if (i == 0 || glyphs->log_clusters[i] != glyphs->log_clusters[i - 1]) { // a new cluster
+					run->cluster_positions.emplace_back(x);
+					run->cluster_characters.emplace_back(byte_chars[static_cast<std::size_t>(glyphs->log_clusters[i])]);
+				}
+				if (info.glyph != PANGO_GLYPH_EMPTY && (info.glyph & PANGO_GLYPH_UNKNOWN_FLAG) == 0) {
+					cairo_glyph_t &glyph = run->glyphs.emplace_back();
+					glyph.index = info.glyph;
+					glyph.x = x + pango_units_to_double(info.geometry.x_offset);
+					glyph.y = run->ascent + pango_units_to_double(info.geometry.y_offset);
+				}
+				x += pango_units_to_double(info.geometry.width);
+			}
+			pango_glyph_string_free(glyphs);
+			run->cluster_positions.emplace_back(x);
+			run->cluster_characters.emplace_back(text.size());
+
+			run->character_clusters.resize(text.size());
+			for (std::size_t cluster = 0; cluster + 1 < run->cluster_characters.size(); ++cluster) {
+				for (
+					std::size_t c = run->cluster_characters[cluster];
+					c < run->cluster_characters[cluster + 1];
+					++c
+				) {
+					run->character_clusters[c] = cluster;
+				}
+			}
+
+			_cache_glyph_run(std::move(key), run);
+			return run;
+		}
+		/// Inserts the given \ref glyph_run into \ref _shaping_cache_current, starting a new generation if it's
+		/// full.
+		void _cache_glyph_run(_shaping_key key, std::shared_ptr<const glyph_run> run) {
+			if (_shaping_cache_current.size() >= _shaping_cache_generation_size) {
+				_shaping_cache_previous = std::move(_shaping_cache_current);
+				_shaping_cache_current = _shaping_cache();
+			}
+			_shaping_cache_current.emplace(std::move(key), std::move(run));
+		}
+		/// Creates a new \ref plain_text, reusing the cached \ref glyph_run if possible.
+		std::unique_ptr<plain_text> _create_plain_text_impl(
+			std::basic_string_view<codepoint> text, ui::font &f, double size
+		) {
+			auto result = std::make_unique<plain_text>();
+			result->_run = _get_glyph_run(text, _details::cast_font(f)._get_font_at_size(size));
+			return result;
+		}
+
+
 		/// Called to finalize drawing to the current rendering target.
 		virtual void _finish_drawing_to_target() = 0;
 
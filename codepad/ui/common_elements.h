@@ -137,6 +137,11 @@ namespace codepad::ui {
 			element::_on_prerender();
 			_check_cache_format();
 		}
+		/// Enables \ref _cache_layer since the text rarely changes.
+		void _initialize(str_view_t cls, const element_configuration &config) override {
+			element::_initialize(cls, config);
+			_cache_layer = true;
+		}
 		/// Renders the text.
 		void _custom_render() const override {
 			element::_custom_render();
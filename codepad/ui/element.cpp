@@ -6,6 +6,9 @@
 /// \file
 /// Implementation of certain methods related to ui::element.
 
+#include <algorithm>
+#include <cmath>
+
 #include "../os/misc.h"
 #include "window.h"
 #include "panel.h"
@@ -69,15 +72,37 @@ namespace codepad::ui {
 		mouse_down.invoke(p);
 	}
 
-	void element::_on_prerender() {
+	matd3x3 element::_get_local_transform() const {
 		vec2d offset = get_layout().xmin_ymin();
 		if (parent()) {
 			offset -= parent()->get_layout().xmin_ymin();
 		}
-		get_manager().get_renderer().push_matrix_mult(
-			matd3x3::translate(offset) * _params.visual_parameters.transform.get_matrix(get_layout().size())
+		return matd3x3::translate(offset) * _params.visual_parameters.transform.get_matrix(get_layout().size());
+	}
+
+	rectd element::_get_window_bounds() const {
+		// the same order in which matrices are multiplied by renderer_base::push_matrix_mult()
+		matd3x3 mat = _get_local_transform();
+		for (const element *e = parent(); e; e = e->parent()) {
+			mat = mat * e->_get_local_transform();
+		}
+		return _get_transformed_bounds(mat, get_layout().size());
+	}
+
+	rectd element::_get_transformed_bounds(const matd3x3 &m, vec2d size) {
+		vec2d
+			p1 = m.transform_position(vec2d()),
+			p2 = m.transform_position(vec2d(size.x, 0.0)),
+			p3 = m.transform_position(vec2d(0.0, size.y)),
+			p4 = m.transform_position(size);
+		return rectd(
+			std::min({ p1.x, p2.x, p3.x, p4.x }), std::max({ p1.x, p2.x, p3.x, p4.x }),
+			std::min({ p1.y, p2.y, p3.y, p4.y }), std::max({ p1.y, p2.y, p3.y, p4.y })
 		);
-		/*get_manager().get_renderer().push_clip(_layout.fit_grid_enlarge<int>());*/ // TODO clips?
+	}
+
+	void element::_on_prerender() {
+		get_manager().get_renderer().push_matrix_mult(_get_local_transform());
 	}
 
 	void element::_custom_render() const {
@@ -88,18 +113,103 @@ namespace codepad::ui {
 	}
 
 	void element::_on_postrender() {
-		/*get_manager().get_renderer().pop_clip();*/
 		get_manager().get_renderer().pop_matrix();
 	}
 
 	void element::_on_render() {
 		if (is_visible(visibility::visual)) {
+			if (parent()) { // windows call begin_drawing() in _on_prerender() and are always rendered
+				matd3x3 trans = _get_local_transform() * get_manager().get_renderer().get_matrix();
+				rectd bounds = _get_transformed_bounds(trans, get_layout().size());
+				window_base *wnd = get_window();
+				if (wnd) {
+					bounds = bounds.translated(wnd->_layer_offset);
+					if (!wnd->is_region_visible(bounds)) {
+						return;
+					}
+				}
+				_rendered_bounds = bounds;
+				// layers are only used for pure translations so that they can be composited without resampling
+				if (wnd && _cache_layer && !trans.has_rotation_or_nonrigid()) {
+					_render_layer(*wnd);
+					return;
+				}
+			}
 			_on_prerender();
 			_custom_render();
 			_on_postrender();
 		}
 	}
 
+	void element::_render_layer(window_base &wnd) {
+		renderer_base &r = get_manager().get_renderer();
+
+		// align the layer to physical pixels so that compositing it does not blur its contents
+		vec2d scaling = wnd.get_scaling_factor();
+		vec2d origin(
+			std::floor(_rendered_bounds.xmin * scaling.x) / scaling.x,
+			std::floor(_rendered_bounds.ymin * scaling.y) / scaling.y
+		);
+		vec2d size(
+			std::ceil((_rendered_bounds.xmax - origin.x) * scaling.x) / scaling.x,
+			std::ceil((_rendered_bounds.ymax - origin.y) * scaling.y) / scaling.y
+		);
+		if (
+			origin.x != _layer.origin.x || origin.y != _layer.origin.y ||
+			scaling.x != _layer.scaling.x || scaling.y != _layer.scaling.y
+			) {
+			_layer.valid = false;
+		}
+
+		if (!_layer.valid) {
+			bool churning = _layer.invalid_frame != 0 && _layer.invalid_frame + 1 == wnd._frame_index;
+			_layer.invalid_frame = wnd._frame_index;
+			if (churning) { // the layer would likely be thrown away immediately; render directly
+				r.get_render_target_pool().release(std::move(_layer.surface));
+				_on_prerender();
+				_custom_render();
+				_on_postrender();
+				return;
+			}
+
+			// the layer is marked as valid before rendering, so that invalidations during rendering are kept
+			_layer.valid = true;
+			matd3x3 parent_matrix = r.get_matrix();
+			if (
+				!_layer.surface.target || size.x != _layer.size.x || size.y != _layer.size.y ||
+				scaling.x != _layer.scaling.x || scaling.y != _layer.scaling.y
+				) {
+				r.get_render_target_pool().release(std::move(_layer.surface));
+				_layer.surface = r.get_render_target_pool().acquire(size, scaling);
+				r.begin_drawing(*_layer.surface.target);
+			} else { // reuse the old surface
+				r.begin_drawing(*_layer.surface.target);
+				r.clear(colord(0.0, 0.0, 0.0, 0.0));
+			}
+			_layer.origin = origin;
+			_layer.size = size;
+			_layer.scaling = scaling;
+
+			// render the subtree as if the layer was placed at its origin in the window
+			window_base::_layer_state state = wnd._begin_layer(rectd::from_corner_and_size(origin, size));
+			r.push_matrix(matd3x3::translate(state.offset - origin) * parent_matrix);
+			_on_prerender();
+			_custom_render();
+			_on_postrender();
+			r.pop_matrix();
+			wnd._end_layer(std::move(state));
+			r.end_drawing();
+		}
+
+		r.push_matrix(matd3x3::translate(_layer.origin - wnd._layer_offset));
+		r.draw_rectangle(
+			rectd::from_corners(vec2d(), _layer.surface.target_bitmap->get_size()),
+			generic_brush_parameters(brush_parameters::bitmap_pattern(_layer.surface.target_bitmap.get())),
+			generic_pen_parameters()
+		);
+		r.pop_matrix();
+	}
+
 	void element::_initialize(str_view_t cls, const element_configuration &config) {
 #ifdef CP_CHECK_USAGE_ERRORS
 		_initialized = true;
@@ -367,6 +367,28 @@ namespace codepad::ui {
 		bool _mouse_over = false; ///< Indicates if the mouse is hoverihg this element.
 	protected:
 		rectd _layout; ///< The absolute layout of the element in the window.
+		/// The bounding box of this element in window coordinates when it was last rendered. When the element is
+		/// invalidated, this region is redrawn along with its new bounds so that stale contents are erased.
+		rectd _rendered_bounds;
+
+		/// The cached rendering result of an element and all its descendants. \sa _cache_layer
+		struct _layer_cache {
+			render_target_data surface; ///< The surface that the element has been rendered onto.
+			vec2d
+				origin, ///< The top left corner of \ref surface in window coordinates.
+				size, ///< The size of \ref surface.
+				scaling; ///< The scaling factor of \ref surface.
+			/// The last frame of the window in which this layer has been found to be invalid. An element that's
+			/// invalidated in two consecutive frames, e.g., because it's being animated, is rendered directly
+			/// instead of through \ref surface.
+			std::size_t invalid_frame = 0;
+			bool valid = false; ///< Whether the contents of \ref surface are up-to-date.
+		};
+		_layer_cache _layer; ///< The cached layer of this element. Only used if \ref _cache_layer is \p true.
+		/// If \p true, this element and all its descendants are rendered onto an offscreen surface that is reused
+		/// until the visual of any element in the subtree is invalidated. This is intended for elements that
+		/// rarely change but are relatively expensive to draw, e.g., labels and tab buttons.
+		bool _cache_layer = false;
 
 		/// Contains information about a change in visibility.
 		using _visibility_changed_info = value_update_info<visibility, value_update_info_contents::old_value>;
@@ -473,6 +495,15 @@ namespace codepad::ui {
 		virtual void _on_update() {
 		}
 
+		/// Returns the transformation from the coordinate system of this element to that of its parent, which
+		/// consists of the offset of this element and its \ref element_parameters::visual_parameters::transform.
+		matd3x3 _get_local_transform() const;
+		/// Returns the bounding box of this element in window coordinates, computed using its current layout and
+		/// the transforms of all its ancestors.
+		rectd _get_window_bounds() const;
+		/// Returns the bounding box of the rectangle from (0, 0) to \p size after being transformed by \p m.
+		static rectd _get_transformed_bounds(const matd3x3 &m, vec2d size);
+
 		/// Called when the element is about to be rendered.
 		virtual void _on_prerender();
 		/// Called when the element is rendered. Renders all \ref visuals::geometries of \ref _params.
@@ -480,9 +511,14 @@ namespace codepad::ui {
 		virtual void _custom_render() const;
 		/// Called after the element has been rendered.
 		virtual void _on_postrender();
-		/// Renders the element if the element is visible for \ref visibility::visual. This function first calls
-		/// \ref _on_prerender(), then calls \ref _custom_render(), and finally calls \ref _on_postrender().
+		/// Renders the element if the element is visible for \ref visibility::visual and is not culled by its
+		/// window, i.e., it intersects both the current clip and the damage region of the window. This function
+		/// first calls \ref _on_prerender(), then calls \ref _custom_render(), and finally calls
+		/// \ref _on_postrender().
 		void _on_render();
+		/// Called by \ref _on_render() if \ref _cache_layer is \p true. Re-renders \ref _layer if necessary, and
+		/// draws it onto the current render target.
+		void _render_layer(window_base&);
 
 		/// Called by the element itself when its desired size has changed. It should be left for the parent to
 		/// decide whether it should invalidate its own layout or call \ref invalidate_layout() on this child.
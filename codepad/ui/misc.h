@@ -652,33 +652,22 @@ namespace codepad {
 		};
 
 
-		/// A temporary \ref render_target, with pixel snapping. The transform of the current render target must not
-		/// change after this is created until the text has been drawn onto the original render target when this is
-		/// disposed or when using \ref finish(). This is mainly used to work around the fact that pushing clips
-		/// (layers) in Direct2D disables subpixel antialiasing.
+		/// A temporary \ref render_target from the \ref render_target_pool, with pixel snapping. The transform of
+		/// the current render target must not change after this is created until the text has been drawn onto the
+		/// original render target when this is disposed or when using \ref finish(). This is mainly used to work
+		/// around the fact that pushing clips (layers) in Direct2D disables subpixel antialiasing.
 		class pixel_snapped_render_target {
 		public:
 			/// Constructs this struct with the renderer, the target area where text is to be drawn, and the scaling
 			/// factor of the current render target. This function computes the offset required for pixel snapping,
 			/// and starts rendering to the temporary render target.
 			pixel_snapped_render_target(renderer_base &r, rectd target_area, vec2d scaling) : _renderer(r) {
-				_target = r.create_render_target(target_area.size(), scaling);
-				vec2d corner = target_area.xmin_ymin();
-				matd3x3 transform = r.get_matrix(), snap_transform = matd3x3::identity();
-				if (!transform.has_rotation_or_nonrigid()) {
-					vec2d trans_corner = corner + vec2d(transform[0][2], transform[1][2]);
-					trans_corner.x *= scaling.x;
-					trans_corner.y *= scaling.y;
-					vec2d offset = vec2d(std::round(trans_corner.x), std::round(trans_corner.y)) - trans_corner;
-					offset.x /= scaling.x;
-					offset.y /= scaling.y;
-					
-					_snapped_position = corner + offset;
-					snap_transform = matd3x3::translate(-offset);
-				}
+				_target = r.get_render_target_pool().acquire(target_area.size(), scaling);
+				vec2d offset = get_snapping_offset(r, target_area.xmin_ymin(), scaling);
+				_snapped_position = target_area.xmin_ymin() + offset;
 
 				_renderer.begin_drawing(*_target.target);
-				_renderer.push_matrix(snap_transform);
+				_renderer.push_matrix(matd3x3::translate(-offset));
 			}
 			/// Calls \ref finish().
 			~pixel_snapped_render_target() {
@@ -702,9 +691,25 @@ namespace codepad {
 					);
 					_renderer.pop_matrix();
 
-					_target.target.reset();
-					_target.target_bitmap.reset();
+					_renderer.get_render_target_pool().release(std::move(_target));
+				}
+			}
+
+			/// Returns the offset that should be added to the given position, in the coordinate system of the
+			/// current render target, so that it's aligned to physical pixels. If the current transform contains
+			/// rotation or non-rigid transformations, no snapping is performed and the offset is zero.
+			inline static vec2d get_snapping_offset(const renderer_base &r, vec2d corner, vec2d scaling) {
+				matd3x3 transform = r.get_matrix();
+				if (transform.has_rotation_or_nonrigid()) {
+					return vec2d();
 				}
+				vec2d trans_corner = corner + vec2d(transform[0][2], transform[1][2]);
+				trans_corner.x *= scaling.x;
+				trans_corner.y *= scaling.y;
+				vec2d offset = vec2d(std::round(trans_corner.x), std::round(trans_corner.y)) - trans_corner;
+				offset.x /= scaling.x;
+				offset.y /= scaling.y;
+				return offset;
 			}
 		protected:
 			/// The position where the temporary buffer should be drawn onto in the original render target, with
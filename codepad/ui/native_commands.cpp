@@ -94,6 +94,17 @@ namespace codepad::ui::native_commands {
 			})
 		);
 
+		reg.register_command(
+			CP_STRLIT("contents_region.carets.move_to_matching_bracket"), convert_type<editor>([](editor *e) {
+				code::contents_region::get_from_editor(*e)->move_all_carets_to_matching_brackets(false);
+			})
+		);
+		reg.register_command(
+			CP_STRLIT("contents_region.carets.move_to_matching_bracket_selected"), convert_type<editor>([](editor *e) {
+				code::contents_region::get_from_editor(*e)->move_all_carets_to_matching_brackets(true);
+			})
+		);
+
 		reg.register_command(
 			CP_STRLIT("contents_region.folding.fold_selected"), convert_type<editor>([](editor *e) {
 				auto *edt = code::contents_region::get_from_editor(*e);
@@ -104,6 +115,46 @@ namespace codepad::ui::native_commands {
 				}
 			})
 		);
+		reg.register_command(
+			CP_STRLIT("contents_region.folding.fold_enclosing_block"), convert_type<editor>([](editor *e) {
+				auto *edt = code::contents_region::get_from_editor(*e);
+				if (auto &brackets = edt->get_bracket_registry()) {
+					for (auto caret : edt->get_carets().carets) {
+						auto block = brackets->find_enclosing_block(caret.first.first);
+						// empty blocks can't be folded, so fold the block that contains them instead
+						while (block && block->second <= block->first + 1) {
+							block = brackets->find_enclosing_block(block->first);
+						}
+						if (block) {
+							edt->add_folded_region(make_pair(block->first + 1, block->second));
+						}
+					}
+				}
+			})
+		);
+		reg.register_command(
+			CP_STRLIT("contents_region.folding.fold_all_blocks"), convert_type<editor>([](editor *e) {
+				auto *edt = code::contents_region::get_from_editor(*e);
+				if (auto &brackets = edt->get_bracket_registry()) {
+					const code::linebreak_registry &lines = edt->get_document()->get_linebreaks();
+					// fold all outermost non-empty blocks that span multiple lines; blocks inside single-line
+					// blocks are on a single line as well
+					vector<code::view_formatting::fold_region> regions;
+					for (auto block : brackets->get_outermost_blocks(0, lines.num_chars())) {
+						if (
+							block.second > block.first + 1 &&
+							lines.get_line_and_column_of_char(block.first).line !=
+							lines.get_line_and_column_of_char(block.second).line
+						) {
+							regions.emplace_back(block.first + 1, block.second);
+						}
+					}
+					if (!regions.empty()) {
+						edt->add_folded_regions(regions);
+					}
+				}
+			})
+		);
 
 		reg.register_command(
 			CP_STRLIT("contents_region.delete_before_carets"), convert_type<editor>([](editor *e) {
@@ -223,7 +274,8 @@ namespace codepad::ui::native_commands {
 				auto files = open_file_dialog(th->get_window(), file_dialog_type::multiple_selection);
 				tab *last = nullptr;
 				for (const auto &path : files) {
-					auto ctx = buffer_manager::get().open_file(path);
+					// map the file so that large files are not loaded into memory
+					auto ctx = buffer_manager::get().open_file(path, buffer::load_mode::mapped);
 
 					tab *tb = th->get_tab_manager().new_tab_in(th);
 					tb->set_label(path.filename().u8string());
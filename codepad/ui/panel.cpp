@@ -160,6 +160,26 @@ namespace codepad::ui {
 		}
 	}
 
+	void panel::_on_prerender() {
+		element::_on_prerender();
+		if (_clip_children) {
+			get_manager().get_renderer().push_rectangle_clip(rectd::from_corners(vec2d(), get_layout().size()));
+			if (window_base *wnd = get_window()) {
+				wnd->_push_clip_bounds(_rendered_bounds);
+			}
+		}
+	}
+
+	void panel::_on_postrender() {
+		if (_clip_children) {
+			if (window_base *wnd = get_window()) {
+				wnd->_pop_clip_bounds();
+			}
+			get_manager().get_renderer().pop_clip();
+		}
+		element::_on_postrender();
+	}
+
 	element *panel::_hit_test_for_child(const mouse_position &p) const {
 		for (element *elem : _children.z_ordered()) {
 			if (elem->is_visible(visibility::interact)) {
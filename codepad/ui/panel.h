@@ -309,6 +309,12 @@ namespace codepad::ui {
 			element::_on_padding_changed();
 		}
 
+		/// If \ref _clip_children is \p true, pushes a clip with the shape of this panel so that children are not
+		/// drawn outside of it, and children outside of the clip are culled.
+		void _on_prerender() override;
+		/// Pops the clip pushed in \ref _on_prerender().
+		void _on_postrender() override;
+
 		/// Renders all element in ascending order of their z-index.
 		void _custom_render() const override {
 			element::_custom_render();
@@ -499,7 +505,10 @@ namespace codepad::ui {
 		bool
 			/// Indicates whether the panel should mark all children for disposal when disposed.
 			_dispose_children = true,
-			_is_focus_scope = false; ///< Indicates if this panel is a focus scope (borrowed from WPF).
+			_is_focus_scope = false, ///< Indicates if this panel is a focus scope (borrowed from WPF).
+			/// Indicates whether the children of this panel are clipped by its layout. Children that are
+			/// completely outside of the clip, e.g., scrolled out of view, are not rendered at all.
+			_clip_children = true;
 	};
 
 
@@ -11,6 +11,33 @@
 using namespace std;
 
 namespace codepad::ui {
+	render_target_data render_target_pool::acquire(vec2d size, vec2d scaling) {
+		_key key(size, scaling);
+		for (auto it = _pooled.rbegin(); it != _pooled.rend(); ++it) {
+			if (it->first == key) {
+				render_target_data result = std::move(it->second);
+				_pooled.erase(std::next(it).base());
+				++_stats.hits;
+				// clear the contents from its previous use
+				_renderer.begin_drawing(*result.target);
+				_renderer.clear(colord(0.0, 0.0, 0.0, 0.0));
+				_renderer.end_drawing();
+				return result;
+			}
+		}
+		++_stats.misses;
+		return _renderer.create_render_target(size, scaling);
+	}
+
+	void render_target_pool::release(render_target_data data) {
+		if (!data.target || !data.target_bitmap) {
+			return;
+		}
+		_key key(data.target_bitmap->get_size(), data.scaling_factor);
+		_pooled.emplace_back(key, std::move(data));
+		_trim();
+	}
+
 	any &renderer_base::_get_window_data(window_base &wnd) {
 		return wnd._renderer_data;
 	}
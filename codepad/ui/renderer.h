@@ -8,15 +8,23 @@
 
 #include <functional>
 #include <algorithm>
+#include <cmath>
 #include <cstring>
 #include <variant>
 #include <any>
+#include <array>
+#include <list>
+#include <map>
+#include <memory>
+#include <tuple>
+#include <unordered_map>
 
 #include "../core/math.h"
 #include "../core/json/misc.h"
 
 namespace codepad::ui {
 	class window_base;
+	class renderer_base;
 
 	/// Determines the style of rendered text.
 	enum class font_style : unsigned char {
@@ -121,12 +129,103 @@ namespace codepad::ui {
 		/// Default constructor.
 		render_target_data() = default;
 		/// Initializes all fields of this struct.
-		render_target_data(std::unique_ptr<render_target> rt, std::unique_ptr<bitmap> bmp) :
-			target(std::move(rt)), target_bitmap(std::move(bmp)) {
+		render_target_data(std::unique_ptr<render_target> rt, std::unique_ptr<bitmap> bmp, vec2d scaling) :
+			target(std::move(rt)), target_bitmap(std::move(bmp)), scaling_factor(scaling) {
 		}
 
 		std::unique_ptr<render_target> target; ///< The \ref render_target.
 		std::unique_ptr<bitmap> target_bitmap; ///< The \ref bitmap.
+		vec2d scaling_factor; ///< The scaling factor that \ref target has been created with.
+	};
+
+	/// A pool of \ref render_target "render_targets" that are no longer used, so that offscreen surfaces can be
+	/// reused instead of being allocated and freed every frame. Render targets are interchangeable if they have the
+	/// same size in physical pixels and the same scaling factor.
+	class render_target_pool {
+	public:
+		/// Statistics about a \ref render_target_pool.
+		struct statistics {
+			std::size_t
+				hits = 0, ///< The number of requests served with a pooled render target.
+				misses = 0, ///< The number of requests for which a new render target has been created.
+				evictions = 0; ///< The number of render targets discarded because the pool is full.
+		};
+
+		/// The default maximum number of render targets in the pool.
+		constexpr static std::size_t default_capacity = 16;
+
+		/// Initializes \ref _renderer.
+		explicit render_target_pool(renderer_base &r) : _renderer(r) {
+		}
+
+		/// Returns a cleared render target with the given size and scaling factor, reusing a pooled one if
+		/// possible. Note that the logical size of a reused render target may differ from \p size by a fraction of
+		/// a physical pixel.
+		render_target_data acquire(vec2d size, vec2d scaling);
+		/// Returns the given render target to the pool. If the pool is full, the render target that has been in
+		/// the pool for the longest time is discarded. Empty \ref render_target_data objects are ignored.
+		void release(render_target_data);
+		/// Discards all pooled render targets.
+		void clear() {
+			_pooled.clear();
+		}
+
+		/// Sets the maximum number of render targets in the pool.
+		void set_capacity(std::size_t cap) {
+			_capacity = cap;
+			_trim();
+		}
+		/// Returns \ref _capacity.
+		[[nodiscard]] std::size_t get_capacity() const {
+			return _capacity;
+		}
+		/// Returns the number of render targets currently in the pool.
+		[[nodiscard]] std::size_t get_pooled_count() const {
+			return _pooled.size();
+		}
+		/// Returns \ref _stats.
+		[[nodiscard]] const statistics &get_statistics() const {
+			return _stats;
+		}
+	protected:
+		/// Identifies interchangeable render targets.
+		struct _key {
+			/// Default constructor.
+			_key() = default;
+			/// Computes the size in physical pixels from the given logical size and scaling factor.
+			_key(vec2d size, vec2d scale) :
+				width(static_cast<int>(std::ceil(size.x * scale.x))),
+				height(static_cast<int>(std::ceil(size.y * scale.y))),
+				scaling(scale) {
+			}
+
+			/// Equality.
+			friend bool operator==(const _key &lhs, const _key &rhs) {
+				return
+					lhs.width == rhs.width && lhs.height == rhs.height &&
+					lhs.scaling.x == rhs.scaling.x && lhs.scaling.y == rhs.scaling.y;
+			}
+
+			int
+				width = 0, ///< The width in physical pixels.
+				height = 0; ///< The height in physical pixels.
+			vec2d scaling; ///< The scaling factor.
+		};
+
+		/// The pooled render targets. Recently released ones are at the back.
+		std::list<std::pair<_key, render_target_data>> _pooled;
+		statistics _stats; ///< Statistics of this pool.
+		std::size_t _capacity = default_capacity; ///< The maximum number of render targets in the pool.
+		renderer_base &_renderer; ///< The renderer used to create and clear render targets.
+
+		/// Discards render targets that have been in the pool for the longest time until the size of the pool does
+		/// not exceed \ref _capacity.
+		void _trim() {
+			while (_pooled.size() > _capacity) {
+				_pooled.pop_front();
+				++_stats.evictions;
+			}
+		}
 	};
 
 	/// The parameters used to identify a font.
@@ -201,8 +300,58 @@ namespace codepad::ui {
 		virtual void set_font_stretch(font_stretch, std::size_t, std::size_t) = 0;
 	};
 
+	/// Caches the widths of characters of a font in em units. Widths of characters in Latin scripts are stored
+	/// in a flat array, while widths of all other characters are stored in pages that are allocated when a
+	/// character in the page is first measured.
+	class character_width_table {
+	public:
+		constexpr static std::size_t
+			dense_size = 0x250, ///< Characters before this are stored in \ref _dense; this ends Latin Extended-B.
+			page_bits = 8, ///< The number of bits of the index of a character inside its page.
+			page_size = static_cast<std::size_t>(1) << page_bits; ///< The number of characters in a page.
+
+		/// Marks all characters as not measured.
+		character_width_table() {
+			_dense.fill(-1.0);
+		}
+
+		/// Returns the cached width of the given character, or a negative value if it has not been measured.
+		[[nodiscard]] double get(codepoint cp) const {
+			if (cp < dense_size) {
+				return _dense[cp];
+			}
+			auto it = _pages.find(cp >> page_bits);
+			return it == _pages.end() ? -1.0 : (*it->second)[cp & (page_size - 1)];
+		}
+		/// Sets the width of the given character.
+		void set(codepoint cp, double width) {
+			if (cp < dense_size) {
+				_dense[cp] = width;
+				return;
+			}
+			auto &page = _pages[cp >> page_bits];
+			if (!page) {
+				page = std::make_unique<_page>();
+				page->fill(-1.0);
+			}
+			(*page)[cp & (page_size - 1)] = width;
+		}
+		/// Marks all characters as not measured.
+		void clear() {
+			_dense.fill(-1.0);
+			_pages.clear();
+		}
+	protected:
+		/// A page of characters.
+		using _page = std::array<double, page_size>;
+
+		std::array<double, dense_size> _dense; ///< Widths of characters before \ref dense_size.
+		std::unordered_map<codepoint, std::unique_ptr<_page>> _pages; ///< Pages indexed by \p cp >> \ref page_bits.
+	};
+
 	/// A font in a font family.
 	class font {
+		friend class font_family;
 	public:
 		/// Default virtual destructor.
 		virtual ~font() = default;
@@ -215,8 +364,19 @@ namespace codepad::ui {
 		/// Returns whether this font contains a glyph for the given codepoint.
 		[[nodiscard]] virtual bool has_character(codepoint) const = 0;
 
-		/// Returns the width of the given character.
-		[[nodiscard]] virtual double get_character_width_em(codepoint) const = 0;
+		/// Returns the width of the given character, calling \ref _get_character_width_em_impl() only if the
+		/// character is not in \ref _width_table.
+		[[nodiscard]] double get_character_width_em(codepoint cp) const {
+			if (!_width_table) {
+				_width_table = std::make_shared<character_width_table>();
+			}
+			double width = _width_table->get(cp);
+			if (width < 0.0) {
+				width = _get_character_width_em_impl(cp);
+				_width_table->set(cp, width);
+			}
+			return width;
+		}
 		/// Returns the maximum width of all given characters.
 		[[nodiscard]] virtual double get_maximum_character_width_em(std::basic_string_view<codepoint> str) const {
 			double res = std::numeric_limits<double>::min();
@@ -225,6 +385,13 @@ namespace codepad::ui {
 			}
 			return res;
 		}
+	protected:
+		/// Cached widths of characters. This may be shared with other fonts of the same family with the same
+		/// parameters; see \ref font_family::_share_character_width_table().
+		mutable std::shared_ptr<character_width_table> _width_table;
+
+		/// Measures the width of the given character.
+		[[nodiscard]] virtual double _get_character_width_em_impl(codepoint) const = 0;
 	};
 
 	/// Represents a family of similar fonts.
@@ -237,6 +404,36 @@ namespace codepad::ui {
 		[[nodiscard]] virtual std::unique_ptr<font> get_matching_font(
 			font_style, font_weight, font_stretch
 		) const = 0;
+		/// Returns a font in this family matching the given description. Unlike \ref get_matching_font(), the
+		/// result is cached so that the same font is returned for the same parameters, which avoids repeatedly
+		/// querying the system for fonts that are created every frame.
+		[[nodiscard]] std::shared_ptr<font> get_matching_font_shared(
+			font_style style, font_weight weight, font_stretch stretch
+		) const {
+			std::shared_ptr<font> &result = _matched_fonts[std::make_tuple(style, weight, stretch)];
+			if (!result) {
+				result = get_matching_font(style, weight, stretch);
+			}
+			return result;
+		}
+	protected:
+		/// Fonts returned by \ref get_matching_font_shared().
+		mutable std::map<std::tuple<font_style, font_weight, font_stretch>, std::shared_ptr<font>> _matched_fonts;
+		/// The \ref character_width_table shared by all fonts with the same parameters created by this family.
+		mutable std::map<
+			std::tuple<font_style, font_weight, font_stretch>, std::shared_ptr<character_width_table>
+		> _width_tables;
+
+		/// Makes the given font share its \ref character_width_table with all other fonts created by this family
+		/// with the same parameters, so that characters are only measured once. Derived classes should call this
+		/// in \ref get_matching_font().
+		void _share_character_width_table(font &f, font_style style, font_weight weight, font_stretch stretch) const {
+			auto &table = _width_tables[std::make_tuple(style, weight, stretch)];
+			if (!table) {
+				table = std::make_shared<character_width_table>();
+			}
+			f._width_table = table;
+		}
 	};
 
 	/// Represents a single line of text with the same font parameters. This is mainly used for code editors.
@@ -450,6 +647,16 @@ namespace codepad::ui {
 
 		/// Returns a font family identified by its name.
 		virtual std::unique_ptr<font_family> find_font_family(str_view_t) = 0;
+		/// Returns a font family identified by its name. Unlike \ref find_font_family(), the results, including
+		/// failed lookups, are cached so that the same family is returned for the same name. Fonts obtained using
+		/// \ref font_family::get_matching_font_shared() from the family are also reused.
+		std::shared_ptr<font_family> find_font_family_shared(str_view_t name) {
+			auto it = _font_families.find(name);
+			if (it == _font_families.end()) {
+				it = _font_families.emplace(str_t(name), find_font_family(name)).first;
+			}
+			return it->second;
+		}
 
 		/// Starts drawing to the given window.
 		virtual void begin_drawing(window_base&) = 0;
@@ -458,8 +665,11 @@ namespace codepad::ui {
 		/// Finishes drawing to the last render target on which \ref begin_drawing() has been called.
 		virtual void end_drawing() = 0;
 
-		/// Clears the current surface using the given color.
+		/// Clears the current surface using the given color. Only the region inside the current clip is cleared.
 		virtual void clear(colord) = 0;
+		/// Returns whether the contents of a window are kept intact between two calls to \ref begin_drawing(), so
+		/// that it's possible to only redraw part of the window.
+		[[nodiscard]] virtual bool preserves_window_contents() const = 0;
 
 		// transform
 		/// Pushes a new matrix onto the stack for subsequent drawing operations.
@@ -530,7 +740,16 @@ namespace codepad::ui {
 		virtual std::unique_ptr<plain_text> create_plain_text(std::basic_string_view<codepoint>, font&, double) = 0;
 		/// Draws the given \ref plain_text at the given position, using the given color.
 		virtual void draw_plain_text(plain_text&, vec2d, colord) = 0;
+
+		/// Returns the \ref render_target_pool that should be used for temporary render targets.
+		render_target_pool &get_render_target_pool() {
+			return _render_target_pool;
+		}
 	protected:
+		render_target_pool _render_target_pool{*this}; ///< Render targets that can be reused.
+		/// Font families returned by \ref find_font_family_shared().
+		std::map<str_t, std::shared_ptr<font_family>, std::less<>> _font_families;
+
 		/// Called to register the creation of a window.
 		virtual void _new_window(window_base&) = 0;
 		/// Called to register the deletion of a window.
@@ -132,19 +132,23 @@ namespace codepad::ui {
 			_layouting = false;
 		}
 
-		/// Marks the given element for re-rendering. This will re-render the whole window,
-		/// but even if the visual of multiple elements in the window is invalidated,
-		/// the window is still rendered once.
+		/// Marks the given element for re-rendering. Only the region of the window covered by the element, both
+		/// before and after the change, will be redrawn, and even if the visual of multiple elements in the window
+		/// is invalidated, the window is still rendered once.
 		void invalidate_visual(element &e) {
 			_dirty.insert(&e);
+			// the cached layers of this element and all its ancestors are no longer valid
+			for (element *cur = &e; cur; cur = cur->parent()) {
+				cur->_layer.valid = false;
+			}
 		}
-		/// Re-renders the windows that contain elements whose visuals are invalidated.
+		/// Re-renders the damaged regions of windows that contain elements whose visuals are invalidated.
 		void update_invalid_visuals() {
 			if (_dirty.empty()) {
 				return;
 			}
 			performance_monitor mon("render", render_time_redline);
-			// gather the list of windows to render
+			// gather the list of windows to render, and the regions that need to be redrawn
 			std::set<window_base*> ss;
 			for (auto i : _dirty) {
 				window_base *wnd = i->get_window();
@@ -152,12 +156,15 @@ namespace codepad::ui {
 					wnd = dynamic_cast<window_base*>(i);
 				}
 				if (wnd) {
+					wnd->_on_element_visual_invalidated(*i);
 					ss.insert(wnd);
 				}
 			}
 			_dirty.clear();
 			for (auto i : ss) {
-				i->_on_render();
+				if (i->_redraw_all || !i->_damage_region.empty()) {
+					i->_on_render();
+				}
 			}
 		}
 
@@ -141,9 +141,10 @@ namespace codepad::ui::tabs {
 			tab_unselected.invoke();
 		}
 
-		/// Initializes \ref _close_btn.
+		/// Initializes \ref _close_btn, and enables \ref _cache_layer.
 		void _initialize(str_view_t cls, const element_configuration &config) override {
 			panel::_initialize(cls, config);
+			_cache_layer = true;
 
 			get_manager().get_class_arrangements().get_or_default(cls).construct_children(*this, {
 				{get_label_name(), _name_cast(_label)},
@@ -14,19 +14,91 @@ using namespace std;
 
 namespace codepad::ui {
 	void window_base::_on_prerender() {
-		get_manager().get_renderer().begin_drawing(*this);
-		get_manager().get_renderer().clear(colord(0.0, 0.0, 0.0, 0.0));
+		renderer_base &r = get_manager().get_renderer();
+		++_frame_index;
+		if (!r.preserves_window_contents()) {
+			_redraw_all = true;
+		}
+		if (_redraw_all) {
+			_damage_region.clear();
+		}
+		r.begin_drawing(*this);
+		if (!_redraw_all) {
+			path_geometry_builder &builder = r.start_path();
+			for (rectd rgn : _damage_region) {
+				builder.move_to(rgn.xmin_ymin());
+				builder.add_segment(rgn.xmax_ymin());
+				builder.add_segment(rgn.xmax_ymax());
+				builder.add_segment(rgn.xmin_ymax());
+				builder.close();
+			}
+			r.end_and_push_path_clip();
+		}
+		r.clear(colord(0.0, 0.0, 0.0, 0.0));
+		_clip_stack.clear();
+		_push_clip_bounds(rectd::from_corners(vec2d(), get_layout().size()));
 		panel::_on_prerender();
 	}
 
 	void window_base::_on_postrender() {
 		panel::_on_postrender();
-		get_manager().get_renderer().end_drawing();
+		renderer_base &r = get_manager().get_renderer();
+		if (!_redraw_all) {
+			r.pop_clip();
+		}
+		_pop_clip_bounds();
+		r.end_drawing(); // the renderer may use the damage region to present the contents
+		_damage_region.clear();
+		_redraw_all = false;
+	}
+
+	void window_base::_on_element_visual_invalidated(element &e) {
+		if (&e == this) {
+			_redraw_all = true;
+			_damage_region.clear();
+		}
+		if (_redraw_all) {
+			return;
+		}
+		_add_damage(e._rendered_bounds);
+		if (e.is_visible(visibility::visual)) {
+			_add_damage(e._get_window_bounds());
+		}
+	}
+
+	void window_base::_add_damage(rectd r) {
+		// enlarge the rectangle slightly to account for antialiasing, and clamp it to the window
+		r = rectd(r.xmin - 1.0, r.xmax + 1.0, r.ymin - 1.0, r.ymax + 1.0).fit_grid_enlarge<double>();
+		r = rectd::common_part(r, rectd::from_corners(vec2d(), get_layout().size()));
+		if (!r.positive_area()) {
+			return;
+		}
+		// merge with all overlapping rectangles; since the merged rectangle may overlap other rectangles that it
+		// previously didn't, start over after each merge
+		for (auto it = _damage_region.begin(); it != _damage_region.end(); ) {
+			if (rectd::common_part(*it, r).positive_area()) {
+				r = rectd::bounding_box(*it, r);
+				_damage_region.erase(it);
+				it = _damage_region.begin();
+			} else {
+				++it;
+			}
+		}
+		_damage_region.emplace_back(r);
+		if (_damage_region.size() > _max_damage_rectangles) {
+			rectd bound = _damage_region.front();
+			for (rectd rgn : _damage_region) {
+				bound = rectd::bounding_box(bound, rgn);
+			}
+			_damage_region.clear();
+			_damage_region.emplace_back(bound);
+		}
 	}
 
 	void window_base::_initialize(str_view_t cls, const element_configuration &metrics) {
 		panel::_initialize(cls, metrics);
 		_is_focus_scope = true;
+		_clip_children = false; // the window is clipped by the surface
 		get_manager().get_renderer()._new_window(*this);
 	}
 
@@ -8,6 +8,7 @@
 
 #include <chrono>
 #include <functional>
+#include <vector>
 
 #include "../core/encodings.h"
 #include "../core/event.h"
@@ -25,6 +26,8 @@ namespace codepad::ui {
 		friend scheduler;
 		friend element_collection;
 		friend renderer_base;
+		friend element;
+		friend panel;
 	public:
 		/// Contains information about the resizing of a window.
 		using size_changed_info = value_update_info<vec2d, value_update_info_contents::new_value>;
@@ -141,6 +144,35 @@ namespace codepad::ui {
 			_capture = nullptr;
 			// TODO send a mouse_move message to correct mouse over information?
 		}
+		/// Returns the region of this window that is being redrawn, as a list of non-overlapping rectangles in
+		/// window coordinates. The list is empty if the entire window is being redrawn. This is only meaningful
+		/// during rendering.
+		[[nodiscard]] const std::vector<rectd> &get_damage_region() const {
+			return _damage_region;
+		}
+		/// Returns whether the given rectangle in window coordinates intersects the region that is being redrawn.
+		[[nodiscard]] bool intersects_damage_region(rectd r) const {
+			if (_redraw_all) {
+				return true;
+			}
+			for (rectd rgn : _damage_region) {
+				if (rectd::common_part(rgn, r).positive_area()) {
+					return true;
+				}
+			}
+			return false;
+		}
+
+		/// Returns whether the given rectangle in window coordinates is visible during rendering, i.e., whether it
+		/// intersects both the current clip and the damage region.
+		[[nodiscard]] bool is_region_visible(rectd r) const {
+			if (!_clip_stack.empty() && !rectd::common_part(_clip_stack.back(), r).positive_area()) {
+				return false;
+			}
+			// layers are reused in later frames, so they're always rendered completely
+			return _layer_depth > 0 || intersects_damage_region(r);
+		}
+
 		/// If the mouse is captured, returns the mouse cursor of \ref _capture; otherwise falls back to
 		/// the default behavior.
 		[[nodiscard]] cursor get_current_display_cursor() const override {
@@ -158,8 +190,68 @@ namespace codepad::ui {
 		/// Invoked when the window's scaling factor has been changed.
 		info_event<scaling_factor_changed_info> scaling_factor_changed;
 	protected:
+		/// The maximum number of rectangles in \ref _damage_region. If there are more, they're merged into their
+		/// bounding box, since clipping against and presenting many small rectangles is not worth it.
+		constexpr static std::size_t _max_damage_rectangles = 8;
+
 		std::any _renderer_data; ///< Renderer-specific data associated with this window.
+		std::vector<rectd> _damage_region; ///< The region that will be redrawn. \sa get_damage_region()
+		/// Bounding boxes of all clips pushed by elements in this window during rendering, in window coordinates.
+		/// Each entry is contained by the previous one.
+		std::vector<rectd> _clip_stack;
 		element *_capture = nullptr; ///< The element that captures the mouse.
+		bool _redraw_all = false; ///< Indicates that the entire window will be redrawn.
+
+		/// Called by the \ref scheduler when the visual of the given element, which is either this window or one
+		/// of its descendants, has been invalidated. Adds both the previous and the current bounds of the element
+		/// to \ref _damage_region.
+		void _on_element_visual_invalidated(element&);
+		/// Adds the given rectangle in window coordinates to \ref _damage_region, merging it with existing
+		/// rectangles that it overlaps.
+		void _add_damage(rectd);
+
+		/// The state of the window saved by \ref _begin_layer().
+		struct _layer_state {
+			std::vector<rectd> clip_stack; ///< The saved \ref _clip_stack.
+			vec2d offset; ///< The saved \ref _layer_offset.
+		};
+		/// The offset from the coordinate system of the current render target to window coordinates. This is
+		/// non-zero when an element is being rendered onto its layer. \sa element::_cache_layer
+		vec2d _layer_offset;
+		std::size_t
+			_layer_depth = 0, ///< The number of layers that are currently being rendered.
+			_frame_index = 0; ///< Incremented every time this window is rendered.
+
+		/// Called when starting to render an element onto its layer that covers the given region in window
+		/// coordinates. Returns the previous state of the window that should be passed to \ref _end_layer().
+		_layer_state _begin_layer(rectd region) {
+			_layer_state result;
+			result.clip_stack = std::move(_clip_stack);
+			result.offset = _layer_offset;
+			_clip_stack.clear();
+			_clip_stack.emplace_back(region);
+			_layer_offset = region.xmin_ymin();
+			++_layer_depth;
+			return result;
+		}
+		/// Called when an element has been rendered onto its layer to restore the previous state.
+		void _end_layer(_layer_state state) {
+			_clip_stack = std::move(state.clip_stack);
+			_layer_offset = state.offset;
+			--_layer_depth;
+		}
+
+		/// Pushes the bounding box of a clip onto \ref _clip_stack.
+		void _push_clip_bounds(rectd r) {
+			if (!_clip_stack.empty()) {
+				r = rectd::common_part(_clip_stack.back(), r);
+			}
+			_clip_stack.emplace_back(r);
+		}
+		/// Pops a clip from \ref _clip_stack.
+		void _pop_clip_bounds() {
+			_clip_stack.pop_back();
+		}
 
 		/// Updates \ref _cached_mouse_position and \ref _cached_mouse_position_timestamp, and returns a
 		/// corresponding \ref mouse_position object. Note that the input position is in device independent units.
@@ -174,9 +266,9 @@ namespace codepad::ui {
 		}
 
 		/// Calls \ref renderer_base::begin_drawing() and \ref renderer_base::clear() to start rendering to this
-		/// window.
+		/// window. If only part of the window is redrawn, the damage region is also pushed as a clip.
 		void _on_prerender() override;
-		/// Calls \ref renderer_base::end_drawing() to stop drawing.
+		/// Calls \ref renderer_base::end_drawing() to stop drawing, then resets the damage region.
 		void _on_postrender() override;
 
 		/// Called when the user clicks the `close' button.